@@ -1,2 +1,7 @@
-cl vasion.c /I C:\dev\include /c /Z7
-link SDL2.lib SDL2main.lib vasion.obj /MANIFEST /LIBPATH:C:\dev\lib\x64 /SUBSYSTEM:console  /out:vasion.exe /debug
+rem a first build bakes the sprite atlas the real one compiles in
+cl vasion.c /I C:\dev\include /c /Z7 /Fovasion_bake.obj
+link SDL2.lib SDL2main.lib ws2_32.lib vasion_bake.obj /LIBPATH:C:\dev\lib\x64 /SUBSYSTEM:console  /out:vasion_bake.exe
+vasion_bake.exe --bake-sprites vasion_sprites.h || exit /b 1
+
+cl vasion.c /DVASION_BAKED_SPRITES /I C:\dev\include /c /Z7
+link SDL2.lib SDL2main.lib ws2_32.lib vasion.obj /MANIFEST /LIBPATH:C:\dev\lib\x64 /SUBSYSTEM:console  /out:vasion.exe /debug
@@ -24,8 +24,34 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include <SDL2/SDL.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VASION_SSE2 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VASION_AVX2 1
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Primitive typedefs
 typedef uint8_t uint8;
@@ -44,12 +70,28 @@ typedef float float32;
 typedef double float64;
 
 typedef uint8 byte;
+
+// 16.16 fixed point, used for everything the simulation touches so results
+// are bit identical across compilers, optimization levels and machines
+typedef int32 fixed;
+
+#ifdef _WIN32
+typedef SOCKET NetSocket;
+#define NET_INVALID_SOCKET INVALID_SOCKET
+#else
+typedef int NetSocket;
+#define NET_INVALID_SOCKET -1
+#endif
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
 // Constants
-static const int cScreenWidth = 240;
-static const int cScreenHeight = 160;
+#define SCREEN_WIDTH 240
+#define SCREEN_HEIGHT 160
+#define SCREEN_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+static const int cScreenWidth = SCREEN_WIDTH;
+static const int cScreenHeight = SCREEN_HEIGHT;
 
 #define INVADER_ROWS 5
 #define INVADER_COLS 11
@@ -62,7 +104,109 @@ static const int cScreenHeight = 160;
 #define MAX_TANK_BULLETS 1
 #define MAX_INVADER_BULLETS 2
 #define MAX_BULLETS 32
-#define MAX_TEXTURES 32
+#define SPRITE_COUNT 13
+#define SHIELD_WIDTH 18
+#define SHIELD_HEIGHT 14
+#define SHIELD_BLAST_SIZE 5
+#define SPRITE_MAX_HEIGHT 16 // rows of collision mask per sprite, a mask row holds 32 pixels
+#define ATLAS_WIDTH 256
+#define ATLAS_HEIGHT 32
+#define BULLET_OWNER_NONE -1
+#define BULLET_OWNER_TANK MAX_INVADERS // invaders own bullets by invader index
+#define MAX_GAME_EVENTS 32 // event types must also fit in an EventList mask
+#define MAX_SCRIPT_TASKS 32
+#define MAX_DIVERS 4
+
+#define ARENA_ALIGN 16
+#define SESSION_ARENA_BYTES (sizeof(BulletPhase) + 4 * ARENA_ALIGN) // one tick's scratch, a little over for alignment
+#define FRAME_ARENA_BYTES (256 * 1024)
+
+#define GLYPH_WIDTH 3
+#define GLYPH_HEIGHT 5
+#define GLYPH_ADVANCE (GLYPH_WIDTH + 1)
+#define GLYPH_FIRST ' '
+#define GLYPH_LAST 'Z'
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+#define MAX_TEXT_RUN 48
+
+#define BOUNDS_BATCH_MAX 64 // one bit each in an overlap mask
+#define BOUNDS_EMPTY 0x3fffffff // far enough out that translating never wraps
+
+#define MAX_PARTICLES 32768 // multiple of 4 for the batched update
+#define PARTICLE_JOB_BATCHES 512 // batches of 4 particles per job
+
+#define MAX_JOB_WORKERS 15
+#define JOB_DEQUE_SIZE 256 // must be a power of two
+#define BULLET_JOB_GRAIN 8
+#define PARTICLE_GRAVITY 120.f
+
+#define VERSUS_BUTTON_LEFT 0x1
+#define VERSUS_BUTTON_RIGHT 0x2
+#define VERSUS_BUTTON_FIRE 0x4
+
+#define NET_DEFAULT_PORT 27960
+#define NET_HISTORY 64 // snapshots kept as delta baselines, must be a power of two
+#define NET_SNAPSHOT_BYTES 288
+#define NET_MAX_PACKET 1200
+#define NET_SHIM_QUEUE 128
+#define NET_MAX_CLIENTS 4
+#define NET_CLIENT_TIMEOUT_MS 3000
+#define NET_SEND_INTERVAL 3 // server sends a snapshot every this many ticks
+#define NET_INTERP_TICKS 6 // clients render this far behind the newest snapshot
+#define NET_UDP_OVERHEAD 28 // IPv4 + UDP headers, for bandwidth reporting
+
+#define FEED_SLOTS 16 // must be a power of two
+#define FEED_MAGIC 0x44465356 // "VSFD"
+#define FEED_VERSION 2
+
+#define AUDIO_SAMPLE_RATE 48000
+#define AUDIO_BUFFER_SAMPLES 256 // ~5.3ms at 48kHz
+#define AUDIO_QUEUE_SIZE 64      // must be a power of two
+#define AUDIO_VOICE_AMPLITUDE 6000
+#define MAX_VOICES 8
+
+#define CAPTURE_QUEUE_SIZE 8          // must be a power of two
+#define CAPTURE_KEYFRAME_INTERVAL 600
+#define CAPTURE_MAX_FRAME_BYTES (SCREEN_PIXELS * 2)
+#define CAPTURE_VERSION 1
+
+#define RECORDING_VERSION 2 // 2 puts sizeof(PlayState) ahead of a saved state
+#define RECORDING_VERSUS 0x1
+#define RECORDING_STRESS 0x2
+#define RECORDING_STATE 0x4 // starts from a saved PlayState instead of the seed, same build only
+#define RECORDING_KILL 0x80 // tick byte flag, the killed invader's index follows
+
+#define TURBO_FRAME_NS 16666667     // one presented frame at 60Hz
+#define TURBO_MIN_BUDGET_NS 4000000 // simulation always gets at least this much of a frame
+#define TURBO_MAX_TICKS 100000
+
+#define HISTORY_SECONDS 600
+#define HISTORY_KEYFRAME_TICKS 300   // bounds the deltas replayed to reach any tick
+#define HISTORY_BYTES_PER_TICK 160   // budget for the delta ring, well above typical play
+#define HISTORY_MAX_REWIND_STEP 64   // ticks per frame once rewind has been held a while
+
+#define HISTOGRAM_SUB_BITS 4 // 16 linear steps per power of two, within 6.25%
+#define HISTOGRAM_BUCKETS ((32 - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+#define HITCH_MS 50
+#define HITCH_WARMUP_FRAMES 60          // startup uploads are not hitches
+#define HITCH_SNAPSHOT_TICKS (2 * SIM_TICK_RATE)
+#define HITCH_AFTER_TICKS (2 * SIM_TICK_RATE)
+#define HITCH_MAX_TICKS (HITCH_SNAPSHOT_TICKS * 2 + HITCH_AFTER_TICKS)
+#define MAX_HITCH_FILES 8
+
+#define RENDER_SEGMENT_TICKS 300 // a keyframe every 5s, plenty of segments to spread over cores
+
+#define FRAME_BUDGET_SHARE 75    // percent of the refresh interval frame work may take before presenting
+#define FRAME_TASK_MAX_DEFER 8   // frames optional work can be put off before it runs anyway
+#define FRAME_MIN_DETAIL 0.25f   // smallest share of particle bursts kept while over budget
+
+#define FX_SHIFT 16
+#define FX_ONE (1 << FX_SHIFT)
+#define FX(v) ((fixed)((v) * FX_ONE)) // constants only, never runtime floats
+
+#define SIM_TICK_RATE 60
+#define SIM_TICK_DT (FX_ONE / SIM_TICK_RATE)
+#define MAX_SIM_TICKS_PER_FRAME 8
 
 #define KEY_LEFT SDL_SCANCODE_LEFT
 #define KEY_RIGHT SDL_SCANCODE_RIGHT
@@ -76,12 +220,12 @@ static const int cScreenHeight = 160;
 //-----------------------------------
 // Math
 typedef struct range {
-    float32 min;
-    float32 max;
+    fixed min;
+    fixed max;
 } Range;
 
 typedef struct point {
-    float32 x, y;
+    fixed x, y;
 } Point;
 
 typedef struct ipoint {
@@ -90,45 +234,89 @@ typedef struct ipoint {
 
 typedef struct rect {
     Point position;
-    float32 width;
-    float32 height;
+    fixed width;
+    fixed height;
 } Rect;
 
 typedef struct bounds {
-    float32 left, right, top, bottom;
+    fixed left, right, top, bottom;
 } Bounds;
 
 typedef struct ibounds {
     int32 left, right, top, bottom;
 } IBounds;
 
+// Many bounds laid out for the batch overlap test. Unused entries hold an
+// inside-out box that overlaps nothing.
+typedef struct bounds_batch {
+    fixed left[BOUNDS_BATCH_MAX];
+    fixed right[BOUNDS_BATCH_MAX];
+    fixed top[BOUNDS_BATCH_MAX];
+    fixed bottom[BOUNDS_BATCH_MAX];
+} BoundsBatch;
+_Static_assert(MAX_INVADERS <= BOUNDS_BATCH_MAX && BOUNDS_BATCH_MAX <= 64,
+    "the swarm's targets have to fit one batch and a batch one 64 bit overlap mask");
+
 typedef struct px_collision_data {
     int32 pixelA, pixelB;
 } PxCollisionData;
 
-typedef struct paletteTexture {
-    SDL_Texture* texture;
-    uint8* data;
+// Palette indexed image. The data behind every sprite is static and shared
+// read-only by all sessions and renderers.
+typedef struct sprite {
+    const uint8* data;
     int width;
     int height;
-} PaletteTexture;
+    const uint32* mask; // a word per row, bit x set where column x is drawn
+} Sprite;
+
+// Every sprite and HUD glyph in one premultiplied RGBA image for a palette,
+// baked from the palette indexed tables. Sizes and collision masks come with
+// it, so nothing past the tables needs to know how big a sprite is.
+typedef struct sprite_atlas {
+    SDL_Rect rects[SPRITE_COUNT]; // where each sprite sits, and its size
+    SDL_Rect glyphs[GLYPH_COUNT]; // from GLYPH_FIRST, in the first palette color
+    uint32 masks[SPRITE_COUNT][SPRITE_MAX_HEIGHT];
+    uint32 pixels[ATLAS_WIDTH * ATLAS_HEIGHT]; // SDL_PIXELFORMAT_ABGR8888
+} SpriteAtlas;
+
+typedef struct atlas_packer {
+    int x;
+    int y;
+    int shelf; // tallest image on the current shelf
+} AtlasPacker;
+
+// xorshift32, owned by the simulation so every session draws the same
+// sequence from the same seed
+typedef struct rng {
+    uint32 state;
+} Rng;
 //-----------------------------------
 
 //-----------------------------------
 // Configuration
 typedef struct config {
-    float32 tankSpeed;
-    float32 tankBulletSpeed;
+    fixed tankSpeed;
+    fixed tankBulletSpeed;
     Point tankFireOffset;
     Range invaderMoveDelay;
     Range invaderRowDelay;
     Range invaderFireDelay;
-    float32 invaderMoveAmount;
-    float32 invaderBulletSpeed;
-    float32 invaderDeathTime;
+    fixed invaderMoveAmount;
+    fixed invaderBulletSpeed;
+    fixed invaderDeathTime;
+    int tankLives;
+    fixed tankRespawnTime;
+    bool versus; // a second player drives the swarm's shooting
+    fixed versusAimDelay;
+    fixed versusFireDelay;
+    Range diveDelay;
+    fixed diveSpeed;
+    fixed diveMaxDepth;
+    Range ufoDelay;
+    fixed ufoSpeed;
+    bool stress; // every wave uses cStressWaveLayout, for benchmarks
 } Config;
-
-Config g_config;
 //-----------------------------------
 
 //-----------------------------------
@@ -140,15 +328,34 @@ typedef struct bullet_state {
     int direction;
     int frame;
     int frameCount;
-    int* ownerHandle;
+    int owner;     // BULLET_OWNER_NONE, BULLET_OWNER_TANK or an invader index
+    int ownerSlot; // index into the owner's bullets array
 } BulletState;
+
+typedef enum bullet_hit_type {
+    BulletHit_None,
+    BulletHit_Invader,
+    BulletHit_Shield,
+    BulletHit_Tank,
+    BulletHit_Ufo,
+} BulletHitType;
+
+// Earliest thing a bullet ran into during one tick of travel
+typedef struct bullet_hit {
+    BulletHitType type;
+    int index;      // invader or shield index
+    fixed distance; // travelled from the start of the tick
+    int32 pixel;    // shield pixel for BulletHit_Shield
+} BulletHit;
 //-----------------------------------
 
 //-----------------------------------
 // Shields
 typedef struct shield_state {
     Rect target;
-    PaletteTexture texture;
+    uint8 pixels[SHIELD_WIDTH * SHIELD_HEIGHT]; // eroded copy of cShieldImageData
+    uint32 mask[SHIELD_HEIGHT];                 // pixels as collision bits, kept in step
+    uint32 version;                             // bumped on every change so renderers can re-upload
 } ShieldState;
 //-----------------------------------
 
@@ -162,6 +369,7 @@ typedef enum tank_mode {
 typedef struct tank_state {
     Rect target;
     TankMode mode;
+    fixed respawnDelay;
     int bullets[MAX_TANK_BULLETS];
 } TankState;
 //-----------------------------------
@@ -177,14 +385,195 @@ typedef enum invader_move {
 typedef struct invader_state {
     Rect target;
     bool active;
-    float32 moveDelay;
-    float32 fireDelay;
-    float32 deathTime;
+    fixed moveDelay;
+    fixed fireDelay;
+    fixed deathTime;
     InvaderMove queuedMove;
     int invaderType;
     int frame;
     int bullets[MAX_INVADER_BULLETS];
+    bool diving;
+    Point diveOffset; // from target, which keeps the invader's slot in the formation
 } InvaderState;
+
+// Incrementally maintained view of the alive swarm. Only changes when an
+// invader dies (swarm_remove) or the swarm moves (swarm_translate) so edge,
+// frontier and shooter queries never have to scan every invader.
+typedef struct swarm_index {
+    int aliveCount;
+    int columnAlive[INVADER_COLS];
+    int columnBottom[INVADER_COLS]; // lowest alive row in each column, -1 when empty
+    int rowAlive[INVADER_ROWS];
+    int leftColumn, rightColumn;    // leftColumn > rightColumn when empty
+    int topRow, bottomRow;
+    Bounds bounds;                  // invader centers
+    Bounds hitBounds;               // bounds grown by the largest invader extents
+    BoundsBatch targets;            // every invader's hit bounds by index, dead ones empty
+} SwarmIndex;
+//-----------------------------------
+
+//-----------------------------------
+// Ufo
+typedef struct ufo_state {
+    Rect target;
+    bool active;
+    int direction;
+    fixed deathTime;
+} UfoState;
+//-----------------------------------
+
+//-----------------------------------
+// Events
+// Things that happened during a game_update, consumed afterwards by systems
+// that live outside of the simulation (audio, effects).
+typedef enum game_event_type {
+    GameEvent_TankShot,
+    GameEvent_InvaderShot,
+    GameEvent_InvaderMarch,
+    GameEvent_InvaderKilled,
+    GameEvent_TankHit,
+    GameEvent_UfoEnter,
+    GameEvent_UfoLeave,
+    GameEvent_ShieldHit,
+    GameEvent_UfoKilled,
+} GameEventType;
+
+typedef struct game_event {
+    GameEventType type;
+    Point position;
+    int param;
+} GameEvent;
+
+typedef struct event_list {
+    GameEvent events[MAX_GAME_EVENTS];
+    int count;
+    uint32 mask; // one bit per type pushed, kept even when the list is full
+} EventList;
+//-----------------------------------
+
+//-----------------------------------
+// Jobs
+typedef void (*JobFunc)(void* data, int begin, int end);
+
+// A slice of a parallel-for. Slices wider than grain split in half when run
+// and leave the other half on the runner's deque for anyone to steal.
+typedef struct job {
+    JobFunc func;
+    void* data;
+    int begin;
+    int end;
+    int grain;
+    SDL_atomic_t* pending;
+} Job;
+
+// Chase-Lev deque: its thread pushes and pops the bottom, thieves take the
+// top, and only a race for the last job needs a CAS
+typedef struct job_deque {
+    SDL_atomic_t top;
+    uint8 pad0[60];
+    SDL_atomic_t bottom;
+    uint8 pad1[60];
+    Job jobs[JOB_DEQUE_SIZE];
+} JobDeque;
+
+typedef struct job_thread {
+    struct job_system* system;
+    int index;
+} JobThread;
+
+// Worker threads plus the thread that created the system, which works on its
+// own parallel-fors instead of waiting. Only that thread may start one.
+typedef struct job_system {
+    int workerCount;
+    SDL_Thread* threads[MAX_JOB_WORKERS];
+    JobThread threadInfo[MAX_JOB_WORKERS];
+    SDL_sem* wake;
+    SDL_atomic_t sleeping;
+    SDL_atomic_t running;
+    JobDeque deques[MAX_JOB_WORKERS + 1]; // the owner's is last
+} JobSystem;
+//-----------------------------------
+
+//-----------------------------------
+// Scripts
+// Stackless coroutines for wave behaviour. A script is a function that
+// switches on task->resume to get back to where it last waited, so locals do
+// not survive a wait and anything a script keeps has to live in its task.
+typedef enum script_id {
+    Script_None,
+    Script_Divers,
+    Script_Dive,
+    Script_Shift,
+    Script_Ufo,
+    Script_UfoPass,
+    Script_Bench,
+    Script_Count,
+} ScriptId;
+
+typedef enum script_wait {
+    ScriptWait_None,
+    ScriptWait_Ticks,
+    ScriptWait_Timer,
+    ScriptWait_Events,
+} ScriptWait;
+
+typedef struct script_task {
+    uint8 script;
+    uint8 wait;
+    uint16 resume;  // source line of the wait, 0 to start over
+    int32 until;    // tick, fixed seconds left or event mask, by wait
+    int16 target;   // whatever the script drives, an invader index for dives
+    int16 counter;
+} ScriptTask;
+
+typedef struct script_context {
+    struct play_state* play;
+    Config* config;
+    fixed dt;
+    uint32 tick;
+    uint32 events; // SCRIPT_EVENT bits of everything since the last run
+} ScriptContext;
+
+// Returns true when the script has finished and its task can be reused
+typedef bool (*ScriptFunc)(ScriptTask* task, ScriptContext* ctx);
+
+#define SCRIPT_EVENT(type) (1u << (type))
+#define SCRIPT_BEGIN(task) switch ((task)->resume) { case 0:
+#define SCRIPT_END(task) } (task)->resume = 0; return true
+#define SCRIPT_SUSPEND(task, kind, value) \
+    do { (task)->wait = (kind); (task)->until = (int32)(value); (task)->resume = __LINE__; return false; case __LINE__:; } while (0)
+#define SCRIPT_WAIT_TICKS(task, ctx, n) SCRIPT_SUSPEND(task, ScriptWait_Ticks, (ctx)->tick + (n))
+#define SCRIPT_WAIT_TIMER(task, seconds) SCRIPT_SUSPEND(task, ScriptWait_Timer, seconds)
+#define SCRIPT_WAIT_EVENTS(task, mask) SCRIPT_SUSPEND(task, ScriptWait_Events, mask)
+#define SCRIPT_YIELD(task, ctx) SCRIPT_WAIT_TICKS(task, ctx, 1)
+
+// What a wave looks like and which scripts run it
+typedef struct wave_layout {
+    uint8 rowTypes[INVADER_ROWS];
+    uint8 left;         // where the grid's first cell starts, in pixels
+    uint8 top;
+    uint8 spacing;      // pixels between cells, which are the size of the largest invader
+    uint8 maxDivers;    // in the air at once, 0 for no dives
+    uint8 shiftMarches; // the formation steps down every this many marches, 0 never
+    bool ufo;
+} WaveLayout;
+//-----------------------------------
+
+//-----------------------------------
+// Memory
+
+// A linear allocator over one block taken at startup. Allocations are freed
+// all at once, either by a reset or by releasing back to an earlier mark, so
+// scratch that only lives for a tick or a frame never goes through malloc or
+// free. A session's arena holds its tick's BulletPhase; the broadphase is an
+// overlap mask in registers and needs no cells or lists. A game's frame arena
+// holds the pixels of shield uploads.
+typedef struct arena {
+    uint8* base;
+    size_t capacity;
+    size_t used;
+    size_t peak; // high water mark, for sizing
+} Arena;
 //-----------------------------------
 
 //-----------------------------------
@@ -194,11 +583,36 @@ typedef struct play_state {
     ShieldState shields[MAX_SHIELDS];
     BulletState bullets[MAX_BULLETS];
     InvaderState invaders[MAX_INVADERS];
+    SwarmIndex swarm;
     InvaderMove moveQueue[INVADER_MOVE_QUEUE_SIZE];
     int moveIndex;
-    float32 moveDelay;
+    fixed moveDelay;
+    uint32 tick;
+    Rng rng;
+    EventList events;
+    uint32 score;
+    int lives; // including the tank in play
+    int wave;
+    int aimColumn; // versus only
+    fixed aimDelay;
+    fixed versusFireDelay;
+    UfoState ufo;
+    ScriptTask scripts[MAX_SCRIPT_TASKS];
+    uint32 scriptEvents; // pushed by scripts last tick, too late for the run that pushed them
+    int diverCount;
 } PlayState;
 
+// Scratch for one tick's bullet update. Every bullet moves and sweeps
+// against the state as it was before any of them hit, in parallel, then hits
+// resolve one at a time in slot order.
+typedef struct bullet_phase {
+    PlayState* play;
+    Config* config;
+    fixed dt;
+    Rect from[MAX_BULLETS];
+    BulletHit hits[MAX_BULLETS];
+} BulletPhase;
+
 typedef struct input_state {
     bool prevKeys[SDL_NUM_SCANCODES];
     bool currKeys[SDL_NUM_SCANCODES];
@@ -207,25 +621,585 @@ typedef struct input_state {
 typedef struct game_state {
     PlayState play;
     InputState input;
+    uint8 remoteButtons; // VERSUS_BUTTON_* held by player two
 } GameState;
 
+// Everything one running game owns. Sessions share nothing mutable, so one
+// process can step as many of them as it likes from any number of threads.
+// jobs, when set, only changes how fast a tick runs, never its result.
+// arena is allocated by the first session_init and kept across restarts, the
+// same memory is reused by every game played on the session. Each tick's
+// scratch is carved above whatever the session keeps there and given back
+// before the tick returns.
+typedef struct session {
+    Config config;
+    GameState state;
+    JobSystem* jobs;
+    Arena arena;
+} Session;
+
+// A line of text as glyphs in the sprite atlas. It is only rebuilt when the
+// value it shows changes, and drawing it is a copy per glyph from the atlas.
+typedef struct text_run {
+    uint8 glyphs[MAX_TEXT_RUN]; // index from GLYPH_FIRST, 0 is a blank
+    int length;
+    int width;
+    int64 value;
+    bool built;
+} TextRun;
+
+// Purely cosmetic, so floats and wall-clock dt are fine and none of it feeds
+// back into the simulation. Structure of arrays so updates stream through
+// memory in batches; dead particles are swap-removed to keep [0, count) live.
+typedef struct particle_pool {
+    float32 x[MAX_PARTICLES];
+    float32 y[MAX_PARTICLES];
+    float32 vx[MAX_PARTICLES];
+    float32 vy[MAX_PARTICLES];
+    float32 life[MAX_PARTICLES];
+    uint8 color[MAX_PARTICLES];
+    SDL_Point points[MAX_PARTICLES];
+    int count;
+    float32 detail; // share of each event's burst spawned, lowered while frames are over budget
+    Rng rng;
+} ParticlePool;
+
+typedef struct hud {
+    TextRun score;
+    TextRun lives;
+    TextRun wave;
+    TextRun debug;
+    bool showDebug;
+    uint64 frameTimeAccum; // ns since the debug line was last refreshed
+    uint32 frameCount;
+    uint32 frameTimeUs;    // average shown on the debug line
+    int particleCount;     // sampled with the frame time
+    TextRun turbo;
+    uint32 turboSpeed;     // shown while fast forwarding, 0 otherwise
+    TextRun rewind;
+    uint32 rewindTicks;    // how far back the shown state is while rewinding, 0 otherwise
+} Hud;
+
+// Work a frame can do without, in the order it gets what is left of the budget
+typedef enum frame_task {
+    FrameTask_Shields,      // erosion uploads, a deferred shield shows its old pixels
+    FrameTask_ParticleDraw,
+    FrameTask_Capture,      // a deferred frame counts as dropped
+    FrameTask_Particles,    // integration, the time it waits is caught up on the next run
+    FrameTask_Hud,          // the debug line
+    FrameTask_Count,
+} FrameTask;
+
+typedef struct frame_task_cost {
+    uint64 estimateNs; // running average of a run
+    uint64 start;      // counter at frame_scheduler_begin
+    uint32 deferred;   // frames in a row it has been put off
+    uint32 runs;
+    uint32 skips;
+} FrameTaskCost;
+
+// Keeps frames inside a time budget. The simulation and core drawing always
+// run; what remains of the budget goes to optional tasks by priority, using
+// the cost each one measured before. Tasks that don't fit wait a few frames,
+// and particle bursts shrink while anything waits.
+typedef struct frame_scheduler {
+    uint64 budgetNs;   // work before presenting, 0 runs everything
+    uint64 coreNs;     // running average of drawing that can't be skipped
+    uint64 optionalNs; // spent on optional tasks since the frame was planned
+    uint32 admitted;   // a bit per FrameTask allowed this frame
+    float32 detail;
+    FrameTaskCost tasks[FrameTask_Count];
+} FrameScheduler;
+
+// Presentation of a session on one renderer. Textures belong to the renderer,
+// never to the session.
 typedef struct game {
     SDL_Window* window;
     SDL_Renderer* renderer;
-    GameState* gameState;
+    Session* session;
+    SDL_Texture* atlas; // every sprite, drawn through cSpriteAtlas.rects
+    SDL_Texture* shieldTextures[MAX_SHIELDS];
+    uint32 shieldVersions[MAX_SHIELDS];
+    Hud hud;
+    ParticlePool* particles;
+    Arena frame; // scratch for one frame's drawing, emptied as each frame starts
+    FrameScheduler scheduler;
+    float32 particleDt; // time particles have waited for while deferred
 } Game;
 //-----------------------------------
 
+//-----------------------------------
+// Display
+typedef struct options {
+    bool software;
+    bool scanlines;
+    const char* capturePath;
+    const char* decodeInputPath;
+    const char* decodeOutputPrefix;
+    uint32 seed;
+    float64 soakSeconds;
+    int soakThreads;
+    uint32 soakEpisodeTicks;
+    int soakSessions;
+    bool soakRepro;
+    uint32 soakReproTicks;
+    uint16 serverPort;
+    const char* connectAddress;
+    uint32 netLatencyMs;
+    uint32 netJitterMs;
+    uint32 netLossPercent;
+    float64 netLoopbackSeconds;
+    const char* feedName;
+    const char* feedReadName;
+    float64 feedReadSeconds;
+    int jobThreads;
+    bool stress;
+    int scriptBenchTasks;
+    float64 scriptBenchSeconds;
+    uint32 jobsBenchTicks;
+    const char* recordPath;
+    const char* replayPath;
+    bool bot;
+    bool turbo;
+    uint32 turboSpeed;
+    int historySeconds;
+    int hitchMs;
+    const char* hitchDir; // where slow frames save recordings, none when NULL
+    const char* renderInputPath;
+    const char* renderOutputPrefix;
+    float64 frameBudgetMs; // below zero to take it from the display, 0 for no budget
+    const char* bakeSpritesPath;
+} Options;
+
+// Owns the renderer the game draws with and gets the finished logical frame
+// onto the window. Accelerated renderers draw into a target texture that is
+// scaled by the GPU. Without one the game draws into a logical-size surface
+// with SDL's software renderer and display_present upscales it by an integer
+// factor straight into the window surface.
+typedef struct display {
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+    SDL_Texture* screenTexture;
+    SDL_Surface* frame;
+    bool software;
+    bool scanlines;
+    int windowWidth;
+    int windowHeight;
+} Display;
+//-----------------------------------
+
+//-----------------------------------
+// Capture
+typedef struct capture_slot {
+    uint32 frame;
+    uint32 timeMs;
+    bool keyframe;
+    int size;
+    uint8 data[CAPTURE_MAX_FRAME_BYTES];
+} CaptureSlot;
+
+// Frames are rasterized as palette indices at logical resolution, XOR'd
+// against the previous frame and run-length coded on the game thread, then
+// handed to a writer thread through a bounded single-producer ring. A full
+// ring drops the frame rather than stalling the game.
+typedef struct capture_state {
+    FILE* file;
+    SDL_Thread* thread;
+    SDL_sem* ready;
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+    SDL_atomic_t running;
+    uint8* prev;
+    uint8* curr;
+    uint8 buffers[2][SCREEN_PIXELS];
+    uint32 frame;
+    uint32 dropped;
+    CaptureSlot slots[CAPTURE_QUEUE_SIZE];
+} CaptureState;
+//-----------------------------------
+
+//-----------------------------------
+// Soak
+typedef struct soak_failure {
+    const char* message;
+    uint32 seed;
+    uint32 tick;
+} SoakFailure;
+
+// Headless randomized-input runner. Workers claim episode seeds from a shared
+// counter, so any failure is reproducible from its seed alone.
+typedef struct soak_state {
+    uint32 baseSeed;
+    uint32 episodeTicks;
+    int sessionsPerWorker;
+    uint64 deadline;
+    SDL_atomic_t nextEpisode;
+    SDL_atomic_t failed;
+    SoakFailure failure;
+} SoakState;
+
+// Per-tick inputs of a session, enough to play it again exactly from its
+// seed. One byte a tick: the tank's keys, player two's buttons and the debug
+// kill key, after which the killed invader's index follows.
+typedef struct recording {
+    FILE* file;
+    uint32 ticks;
+    PlayState* start;    // RECORDING_STATE only, what to play from instead of the seed
+    uint8 startButtons;  // held on the tick before start, so the first edges match
+} Recording;
+
+// Fast forward for watching long sessions. Each presented frame runs as many
+// ticks as the wanted speed asks for and fit in what drawing the frame leaves
+// of its budget, and only the last state of the batch is drawn.
+typedef struct turbo_state {
+    bool enabled;
+    uint32 speed;         // wanted multiple of real time, 0 for as fast as it goes
+    uint64 tickNs;        // running average cost of a tick
+    uint64 drawNs;        // running average cost of rendering and presenting
+    uint64 simulatedNs;   // game time run since achievedSpeed was refreshed
+    uint64 elapsedNs;
+    uint32 achievedSpeed; // multiple of real time over the last half second
+} TurboState;
+
+// Where one tick of history sits in the data ring
+typedef struct history_tick {
+    uint32 offset;
+    uint16 size;
+    bool keyframe; // encoded against zeros instead of the tick before
+} HistoryTick;
+
+// The last few minutes of play, one XOR delta against the tick before per
+// tick and a keyframe every HISTORY_KEYFRAME_TICKS. Both rings are sized once;
+// when either fills up, the oldest keyframe and its deltas go together so the
+// oldest tick held always starts a keyframe.
+typedef struct history {
+    Arena memory;
+    HistoryTick* ticks;
+    uint32 tickCapacity;
+    uint32 first;     // ring index of the oldest tick held
+    uint32 count;
+    uint32 firstTick; // PlayState.tick of the oldest tick held
+    uint8* data;
+    uint32 dataCapacity;
+    uint32 head;      // where the next tick is written
+    uint32 sinceKeyframe;
+    PlayState* prev;  // the last tick recorded, what the next delta is against
+    uint8* encoded;   // worst case encoding of one tick
+    uint64 recordNs;  // spent recording, for the exit report
+    uint64 recorded;
+} History;
+
+// Counts of microsecond values in log-linear buckets: exact below 16us and
+// within 1/16th of the value above, so tails read as precisely as medians.
+typedef struct histogram {
+    uint32 counts[HISTOGRAM_BUCKETS];
+    uint64 total;
+    uint32 max;
+} Histogram;
+
+typedef enum frame_stage {
+    FrameStage_Frame,   // start of one frame to the start of the next
+    FrameStage_Update,  // every tick run in the frame
+    FrameStage_Render,
+    FrameStage_Present,
+    FrameStage_Count,
+} FrameStage;
+
+// Where the time of real time frames goes. Fast forwarded and rewinding
+// frames are busy on purpose and left out.
+typedef struct frame_stats {
+    Histogram stages[FrameStage_Count];
+    uint32 last[FrameStage_Count]; // microseconds, the frame before
+    uint32 hitchUs;                // slower frames are hitches, 0 to not look
+    uint32 hitches;
+} FrameStats;
+
+// A finished hitch as the writer thread turns it into a recording
+typedef struct hitch_save {
+    Config config;
+    PlayState start;
+    uint8 startButtons;
+    uint32 hitchTick;
+    uint32 tickCount;
+    uint8 buttons[HITCH_MAX_TICKS]; // from start.tick on
+    int16 kills[HITCH_MAX_TICKS];
+} HitchSave;
+
+// Inputs since a recent snapshot of play, enough to replay the seconds around
+// a hitch. A saved hitch starts from the older of two snapshots taken
+// HITCH_SNAPSHOT_TICKS apart and runs HITCH_AFTER_TICKS past the hitch. The
+// file is written on its own thread so saving one hitch can't cause the next;
+// a hitch that finishes while the last is still being written is dropped.
+typedef struct hitch_recorder {
+    PlayState snapshots[2]; // oldest first
+    uint8 snapshotButtons[2];
+    int snapshotCount;
+    uint32 nextTick;        // a tick other than this one means rewound or restarted
+    uint8 buttons[HITCH_MAX_TICKS];
+    int16 kills[HITCH_MAX_TICKS];
+    uint32 hitchTick;
+    uint32 saveTick;        // 0 when no hitch is waiting to be saved
+    uint32 seed;
+    int saved;
+    const char* directory;
+    SDL_Thread* thread;
+    SDL_sem* ready;
+    SDL_atomic_t pending;   // save is handed to the writer until it sets this back to 0
+    SDL_atomic_t running;
+    HitchSave save;
+} HitchRecorder;
+
+// A recording split into keyframed segments that render independently. A
+// serial pass finds where each segment starts; that is only simulation, the
+// rasterizing and writing that dominate run on every core. Image n is the
+// state after the recording's tick n no matter how segments are spread.
+typedef struct replay_render {
+    Config config;
+    uint32 seed;
+    uint32 tickCount;
+    uint8* buttons;
+    int16* kills;
+    int segmentCount;
+    GameState* keyframes;  // state each segment starts from
+    uint64* endHashes;     // play_hash each segment has to end on
+    const char* outputPrefix;
+    SDL_atomic_t frames;
+    SDL_atomic_t mismatched;
+} ReplayRender;
+
+// One soaked session and the random player driving it
+typedef struct soak_session {
+    Session session;
+    Rng input;
+    int move;
+    uint32 seed;
+    uint32 tick;
+    bool remoteInput; // player two's buttons are set by the caller, not the random player
+} SoakSession;
+
+// Each worker hosts a fleet of sessions and steps them round-robin
+typedef struct soak_worker {
+    SoakState* soak;
+    SDL_Thread* thread;
+    SoakSession* sessions;
+    uint64 ticks;
+    uint32 episodes;
+} SoakWorker;
+//-----------------------------------
+
+//-----------------------------------
+// Net
+typedef enum net_packet_type {
+    NetPacket_Snapshot = 1,
+    NetPacket_Input = 2,
+} NetPacketType;
+
+// Quantized view of PlayState with a fixed layout, so XOR against an older
+// snapshot is mostly zeros. Invaders march in lockstep and are sent as one
+// swarm offset from the wave layout plus an active mask.
+typedef struct net_snapshot {
+    uint32 tick;
+    uint32 score;
+    uint8 lives;
+    uint8 wave;
+    uint8 tankMode;
+    uint8 aimColumn;
+    uint16 tankX;          // quarter pixels
+    int16 swarmX, swarmY;  // quarter pixels, where the grid's first cell is now
+    uint8 gridPitchX;      // pixels from one cell to the next, see invader_grid_pitch
+    uint8 gridPitchY;
+    uint8 invaderFrame;    // march animation parity
+    uint8 invaderActive[(MAX_INVADERS + 7) / 8];
+    uint32 bulletActive;   // one bit per bullet slot
+    uint8 bulletX[MAX_BULLETS];
+    uint8 bulletY[MAX_BULLETS];
+    uint8 bulletInfo[MAX_BULLETS]; // bit 0 invader bullet, bit 1 animation frame
+    uint8 shields[MAX_SHIELDS][(SHIELD_WIDTH * SHIELD_HEIGHT + 7) / 8];
+    int16 ufoX;
+    uint8 ufoMode;                 // 0 gone, 1 flying, 2 exploding
+    uint16 rowTypes;               // invader type of each row, two bits each
+    uint8 diverIndex[MAX_DIVERS];  // invader index + 1, 0 for an unused slot
+    int8 diverX[MAX_DIVERS];       // dive offset in pixels
+    uint8 diverY[MAX_DIVERS];
+} NetSnapshot;
+
+// Bytes net_snapshot_pack writes, field for field in the same order
+#define NET_SNAPSHOT_PACKED_BYTES (4 + 4 + 1 + 1 + 1 + 1 + 2 + 2 + 2 + 1 + 1 + 1 + (MAX_INVADERS + 7) / 8 + 4 + \
+    3 * MAX_BULLETS + MAX_SHIELDS * ((SHIELD_WIDTH * SHIELD_HEIGHT + 7) / 8) + 2 + 1 + 2 + 3 * MAX_DIVERS)
+_Static_assert(NET_SNAPSHOT_PACKED_BYTES <= NET_SNAPSHOT_BYTES, "a packed NetSnapshot has to fit NET_SNAPSHOT_BYTES");
+
+typedef struct net_packet {
+    uint64 releaseMs;
+    struct sockaddr_in to;
+    int size;
+    uint8 data[NET_MAX_PACKET];
+} NetPacket;
+
+// Non-blocking UDP socket. Sends can go through a shim that delays, jitters
+// and drops packets to test against bad networks on localhost.
+typedef struct net_link {
+    NetSocket socket;
+    uint32 latencyMs;
+    uint32 jitterMs;
+    uint32 lossPercent;
+    Rng rng;
+    NetPacket* queue;
+    int queued;
+    uint64 bytesSent;
+    uint32 packetsSent;
+    uint32 packetsDropped;
+} NetLink;
+
+typedef struct net_client_slot {
+    bool active;
+    struct sockaddr_in address;
+    uint32 ack;      // newest snapshot the client has, 0 for none
+    uint8 buttons;
+    uint64 lastHeardMs;
+    uint64 bytesSent;
+    uint32 keyframes;
+} NetClientSlot;
+
+// Authoritative server. The first client to connect is player two, any
+// later ones spectate.
+typedef struct net_server {
+    NetLink link;
+    NetClientSlot clients[NET_MAX_CLIENTS];
+    uint32 historyTick[NET_HISTORY];
+    uint8 history[NET_HISTORY][NET_SNAPSHOT_BYTES];
+} NetServer;
+
+typedef struct net_client {
+    NetLink link;
+    struct sockaddr_in server;
+    uint32 latestTick;
+    float64 renderTick;
+    uint64 bytesReceived;
+    uint32 historyTick[NET_HISTORY];
+    uint8 history[NET_HISTORY][NET_SNAPSHOT_BYTES];
+} NetClient;
+//-----------------------------------
+
+//-----------------------------------
+// Feed
+// One tick of the live feed. The writer makes sequence odd, fills the slot
+// and makes it even again; a reader keeps its copy only if it saw the same
+// even sequence before and after.
+typedef struct feed_slot {
+    SDL_atomic_t sequence;
+    uint32 tick;
+    uint8 pad[56];
+    uint8 data[NET_SNAPSHOT_BYTES];
+} FeedSlot;
+
+// Layout of the shared mapping, little endian so any tool can read it. Each
+// slot's data is the packed net snapshot of its tick.
+typedef struct feed_header {
+    uint32 magic;
+    uint32 version;
+    uint32 slotCount;
+    uint32 slotBytes;
+    SDL_atomic_t latestTick;
+    uint8 pad[44];
+    FeedSlot slots[FEED_SLOTS];
+} FeedHeader;
+
+// Publishes every tick's state to shared memory for out of process readers.
+// The game never waits on them: a slow reader just misses ticks.
+typedef struct feed_state {
+    FeedHeader* header;
+    bool owner;
+    char name[64];
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    NetSnapshot snapshot;
+} FeedState;
+//-----------------------------------
+
+//-----------------------------------
+// Audio
+typedef enum sound_id {
+    Sound_March1,
+    Sound_March2,
+    Sound_March3,
+    Sound_March4,
+    Sound_TankShot,
+    Sound_InvaderShot,
+    Sound_InvaderExplosion,
+    Sound_TankExplosion,
+    Sound_Ufo,
+    Sound_Count,
+} SoundId;
+
+typedef enum waveform {
+    Waveform_Square,
+    Waveform_Noise,
+} Waveform;
+
+typedef struct sound_def {
+    Waveform waveform;
+    float32 startFreq;
+    float32 endFreq;
+    float32 duration;    // seconds, 0 loops until stopped
+    float32 volume;
+    float32 warbleFreq;  // pitch LFO rate in Hz
+    float32 warbleDepth; // pitch LFO deviation in Hz
+} SoundDef;
+
+typedef enum audio_command_type {
+    AudioCommand_Play,
+    AudioCommand_Stop,
+} AudioCommandType;
+
+typedef struct audio_command {
+    uint8 type;
+    uint8 sound;
+} AudioCommand;
+
+// Wait-free single producer (game thread) / single consumer (audio callback)
+// ring. Each side only ever writes its own index.
+typedef struct audio_queue {
+    AudioCommand commands[AUDIO_QUEUE_SIZE];
+    SDL_atomic_t head;
+    SDL_atomic_t tail;
+} AudioQueue;
+
+// All voice math is fixed point: phases are 32-bit accumulators that wrap
+// once per cycle and gains are 16.16.
+typedef struct voice {
+    int sound; // -1 when idle
+    Waveform waveform;
+    uint32 phase;
+    uint32 phaseStep;
+    int32 phaseSweep;
+    uint32 lfoPhase;
+    uint32 lfoStep;
+    int32 lfoDepth;
+    int32 gain;
+    int32 gainStep;
+    int32 samplesLeft; // -1 loops
+    uint32 noise;
+} Voice;
+
+typedef struct audio_state {
+    SDL_AudioDeviceID device;
+    int sampleRate;
+    AudioQueue queue;
+    Voice voices[MAX_VOICES];
+} AudioState;
+//-----------------------------------
+
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
 // Static data tables
-static SDL_Color cColorPalette[2] = {
+static const SDL_Color cColorPalette[2] = {
     { 255, 255, 255, 255 },
     { 0, 255, 0, 255 },
 };
 
-static uint8 cTankImageData[13 * 8] = {
+static const uint8 cTankImageData[] = {
     0, 0, 0, 0, 0, 0, 2, 0, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 2, 2, 2, 0, 0, 0, 0, 0,
     0, 0, 0, 0, 0, 2, 2, 2, 0, 0, 0, 0, 0,
@@ -236,7 +1210,7 @@ static uint8 cTankImageData[13 * 8] = {
     2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
 };
 
-static uint8 cInvader1Frame1ImageData[12 * 8] = {
+static const uint8 cInvader1Frame1ImageData[] = {
     0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0,
     0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
     1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
@@ -247,7 +1221,7 @@ static uint8 cInvader1Frame1ImageData[12 * 8] = {
     0, 0, 1, 1, 0, 0, 0, 0, 1, 1, 0, 0,
 };
 
-static uint8 cInvader1Frame2ImageData[12 * 8] = {
+static const uint8 cInvader1Frame2ImageData[] = {
     0, 0, 0, 0, 1, 1, 1, 1, 0, 0, 0, 0,
     0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0,
     1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
@@ -258,7 +1232,7 @@ static uint8 cInvader1Frame2ImageData[12 * 8] = {
     1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
 };
 
-static uint8 cInvader2Frame1ImageData[13 * 8] = {
+static const uint8 cInvader2Frame1ImageData[] = {
     0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0,
     0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0,
     0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0,
@@ -269,7 +1243,7 @@ static uint8 cInvader2Frame1ImageData[13 * 8] = {
     0, 0, 0, 0, 1, 1, 0, 1, 1, 0, 0, 0, 0,
 };
 
-static uint8 cInvader2Frame2ImageData[13 * 8] = {
+static const uint8 cInvader2Frame2ImageData[] = {
     0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0, 0,
     0, 1, 0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 0,
     0, 1, 0, 1, 1, 1, 1, 1, 1, 1, 0, 1, 0,
@@ -280,7 +1254,7 @@ static uint8 cInvader2Frame2ImageData[13 * 8] = {
     0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
 };
 
-static uint8 cInvader3Frame1ImageData[8 * 8] = {
+static const uint8 cInvader3Frame1ImageData[] = {
     0, 0, 0, 1, 1, 0, 0, 0,
     0, 0, 1, 1, 1, 1, 0, 0,
     0, 1, 1, 1, 1, 1, 1, 0,
@@ -291,7 +1265,7 @@ static uint8 cInvader3Frame1ImageData[8 * 8] = {
     0, 1, 0, 0, 0, 0, 1, 0,
 };
 
-static uint8 cInvader3Frame2ImageData[8 * 8] = {
+static const uint8 cInvader3Frame2ImageData[] = {
     0, 0, 0, 1, 1, 0, 0, 0,
     0, 0, 1, 1, 1, 1, 0, 0,
     0, 1, 1, 1, 1, 1, 1, 0,
@@ -302,7 +1276,7 @@ static uint8 cInvader3Frame2ImageData[8 * 8] = {
     1, 0, 1, 0, 0, 1, 0, 1,
 };
 
-static uint8 cExplosionImageData[13 * 8] = {
+static const uint8 cExplosionImageData[] = {
     0, 0, 0, 0, 1, 0, 0, 0, 1, 0, 0, 0, 0,
     0, 1, 0, 0, 0, 1, 0, 1, 0, 0, 0, 1, 0,
     0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0,
@@ -313,11 +1287,24 @@ static uint8 cExplosionImageData[13 * 8] = {
     0, 1, 0, 0, 1, 0, 0, 0, 1, 0, 0, 1, 0,
 };
 
-static int cInvaderTextureTable[3] = { 1, 3, 5 };
-static int cInvaderWidthTable[3] = { 12, 13, 8 };
-static int cInvaderHeightTable[3] = { 8, 8, 8 };
+static const int cInvaderTextureTable[3] = { 1, 3, 5 };
+static const int cInvaderScoreTable[3] = { 10, 20, 30 };
+static const int cUfoScoreTable[4] = { 50, 100, 150, 300 };
+
+// Waves past the end of the table repeat the last one
+static const WaveLayout cWaveLayouts[] = {
+    // row types, left, top, spacing, divers, shift, ufo
+    { { 2, 1, 1, 0, 0 }, 10, 20, 4, 0, 0, true },
+    { { 2, 1, 1, 0, 0 }, 10, 32, 4, 1, 0, true },
+    { { 2, 2, 1, 1, 0 }, 10, 32, 4, 2, 0, true },
+    { { 2, 2, 1, 1, 0 }, 10, 44, 4, 2, 16, true },
+    { { 2, 2, 2, 1, 1 }, 10, 44, 4, 3, 12, true },
+};
+
+// Everything at once, for benchmarks and for soaking the scripts
+static const WaveLayout cStressWaveLayout = { { 2, 2, 2, 2, 2 }, 10, 20, 4, MAX_DIVERS, 6, true };
 
-static uint8 cUfoImageData[16 * 7] = {
+static const uint8 cUfoImageData[] = {
     0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
     0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0,
     0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0,
@@ -327,13 +1314,13 @@ static uint8 cUfoImageData[16 * 7] = {
     0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
 };
 
-static uint8 cTankBulletImageData[1 * 3] = {
+static const uint8 cTankBulletImageData[] = {
     2,
     2,
     2,
 };
 
-static uint8 cInvaderBulletFrame1ImageData[3 * 5] = {
+static const uint8 cInvaderBulletFrame1ImageData[] = {
     0, 1, 0,
     1, 0, 0,
     0, 1, 0,
@@ -341,7 +1328,7 @@ static uint8 cInvaderBulletFrame1ImageData[3 * 5] = {
     0, 1, 0,
 };
 
-static uint8 cInvaderBulletFrame2ImageData[3 * 5] = {
+static const uint8 cInvaderBulletFrame2ImageData[] = {
     0, 1, 0,
     0, 0, 1,
     0, 1, 0,
@@ -349,7 +1336,7 @@ static uint8 cInvaderBulletFrame2ImageData[3 * 5] = {
     0, 1, 0,
 };
 
-static uint8 cShieldImageData[18 * 14] = {
+static const uint8 cShieldImageData[SHIELD_WIDTH * SHIELD_HEIGHT] = {
     0, 0, 0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0, 0,
     0, 0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0, 0,
     0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 0,
@@ -379,19 +1366,133 @@ static const uint8 cInvaderBulletFrame1Texture = 9;
 static const uint8 cInvaderBulletFrame2Texture = 10;
 static const uint8 cExplosionTexture = 11;
 static const uint8 cShieldTexture = 12;
+
+#ifdef VASION_BAKED_SPRITES
+// written by vasion --bake-sprites, see the Makefile
+#include "vasion_sprites.h"
+#else
+// Nothing baked at build time, sprite_atlas_bake fills this in as main starts
+// and it is read-only from then on
+static SpriteAtlas cSpriteAtlas;
+#endif
+
+// The one place sprite sizes are written down, heights follow from the data
+#define SPRITE(data, width, index) { data, width, (int)sizeof(data) / (width), cSpriteAtlas.masks[index] }
+
+static const Sprite cSprites[SPRITE_COUNT] = {
+    SPRITE(cTankImageData, 13, 0),
+    SPRITE(cInvader1Frame1ImageData, 12, 1),
+    SPRITE(cInvader1Frame2ImageData, 12, 2),
+    SPRITE(cInvader2Frame1ImageData, 13, 3),
+    SPRITE(cInvader2Frame2ImageData, 13, 4),
+    SPRITE(cInvader3Frame1ImageData, 8, 5),
+    SPRITE(cInvader3Frame2ImageData, 8, 6),
+    SPRITE(cUfoImageData, 16, 7),
+    SPRITE(cTankBulletImageData, 1, 8),
+    SPRITE(cInvaderBulletFrame1ImageData, 3, 9),
+    SPRITE(cInvaderBulletFrame2ImageData, 3, 10),
+    SPRITE(cExplosionImageData, 13, 11),
+    SPRITE(cShieldImageData, SHIELD_WIDTH, 12),
+};
+
+// Cleared out of a shield around every hit pixel
+static const uint8 cShieldBlastData[SHIELD_BLAST_SIZE * SHIELD_BLAST_SIZE] = {
+    1, 0, 0, 1, 0,
+    0, 1, 1, 1, 1,
+    1, 1, 1, 1, 0,
+    0, 1, 1, 1, 1,
+    1, 0, 1, 0, 0,
+};
+
+// 3x5 glyphs from ' ' to 'Z', one bit per pixel, row major from the top bit.
+// Characters without a glyph draw as blanks.
+static const uint16 cGlyphData[GLYPH_COUNT] = {
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, //  !"#$%&'
+    0x0000, 0x0000, 0x0000, 0x0000, 0x0000, 0x01c0, 0x0002, 0x12a4, // ()*+,-./
+    0x7b6f, 0x2c97, 0x73e7, 0x72cf, 0x5bc9, 0x79cf, 0x79ef, 0x7292, // 01234567
+    0x7bef, 0x7bcf, 0x0410, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000, // 89:;<=>?
+    0x0000, 0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7, 0x79a4, 0x396b, // @ABCDEFG
+    0x5bed, 0x7497, 0x126a, 0x5bad, 0x4927, 0x5fed, 0x6b6d, 0x2b6a, // HIJKLMNO
+    0x6ba4, 0x2b73, 0x6bad, 0x388e, 0x7492, 0x5b6f, 0x5b6a, 0x5bfd, // PQRSTUVW
+    0x5aad, 0x5a92, 0x72a7,                                         // XYZ
+};
+
+static const SDL_Color cCaptureBackground = { 32, 32, 48, 255 };
+
+static const SoundDef cSoundTable[Sound_Count] = {
+    { Waveform_Square, 98.f, 98.f, 0.09f, 0.8f, 0.f, 0.f },       // March1
+    { Waveform_Square, 87.f, 87.f, 0.09f, 0.8f, 0.f, 0.f },       // March2
+    { Waveform_Square, 78.f, 78.f, 0.09f, 0.8f, 0.f, 0.f },       // March3
+    { Waveform_Square, 73.f, 73.f, 0.09f, 0.8f, 0.f, 0.f },       // March4
+    { Waveform_Square, 1400.f, 300.f, 0.12f, 0.35f, 0.f, 0.f },   // TankShot
+    { Waveform_Noise, 6000.f, 3000.f, 0.06f, 0.2f, 0.f, 0.f },    // InvaderShot
+    { Waveform_Noise, 3000.f, 800.f, 0.3f, 0.7f, 0.f, 0.f },      // InvaderExplosion
+    { Waveform_Noise, 1200.f, 200.f, 1.0f, 0.9f, 0.f, 0.f },      // TankExplosion
+    { Waveform_Square, 700.f, 700.f, 0.f, 0.3f, 8.f, 180.f },     // Ufo
+};
 ////////////////////////////////////////////////////////////////////////////////
 
-void game_init(Game* self);
-void game_update(Game* self, float32 dt);
-void game_render(Game* self);
+void configure(Config* config);
 
-void play_reset(PlayState* self);
+void session_init(Session* self, uint32 seed);
+void session_free(Session* self);
+void session_update(Session* self, fixed dt);
+
+void game_init(Game* self, SDL_Window* window, SDL_Renderer* renderer, Session* session);
+void game_shutdown(Game* self);
+void game_render(Game* self);
+void game_sync_shields(Game* self);
+void game_update_particles(Game* self, JobSystem* jobs, float32 dt);
+void frame_scheduler_init(FrameScheduler* self, uint64 budgetNs);
+void frame_scheduler_plan(FrameScheduler* self, uint64 frameStart, uint32 wanted);
+bool frame_scheduler_begin(FrameScheduler* self, FrameTask task);
+void frame_scheduler_end(FrameScheduler* self, FrameTask task);
+void frame_scheduler_core(FrameScheduler* self, uint64 ns);
+void frame_scheduler_report(FrameScheduler* self);
+
+void play_reset(PlayState* self, Config* config);
+void play_start_wave(PlayState* self, Config* config);
 void tank_reset(TankState* self);
+void tank_kill(PlayState* self, Config* config);
+void versus_update(PlayState* self, Config* config, uint8 buttons, fixed dt);
+void invader_grid_position(const WaveLayout* layout, int index, int* x, int* y);
+void invader_grid_pitch(const WaveLayout* layout, int* x, int* y);
 void bullet_reset(BulletState* self);
-void bullet_remove(BulletState* self);
-void bullet_create(BulletState* self, int x, int y, int bulletType, int* ownerHandle);
-void invader_reset(InvaderState* self, int x, int y, int invaderType);
-void shield_damage(ShieldState* self, Game* game, int32* indices, int32 count);
+void bullet_remove(PlayState* play, BulletState* self);
+void bullet_create(BulletState* self, int x, int y, int bulletType, int owner, int ownerSlot);
+int* bullet_owner_handles(PlayState* play, int owner);
+int bullet_alloc(PlayState* play, int owner);
+bool bullet_sweep(PlayState* play, BulletState* self, Rect* from, BulletHit* hit);
+void bullet_phase_move(void* data, int begin, int end);
+void play_check_wave_end(PlayState* self, Config* config);
+const char* play_check_invariants(PlayState* self);
+void invader_reset(InvaderState* self, int x, int y, int invaderType, Config* config, Rng* rng);
+void invader_kill(PlayState* self, Config* config, int index);
+Rect invader_hit_rect(InvaderState* self);
+bool invader_fire(PlayState* self, int shooter);
+void invader_dive_move(PlayState* self, int index, fixed dx, fixed dy);
+void ufo_reset(UfoState* self);
+void ufo_kill(PlayState* self, Config* config);
+const WaveLayout* wave_layout(Config* config, int wave);
+void play_shift_formation(PlayState* self, fixed dy);
+void play_run_scripts(PlayState* self, Config* config, fixed dt);
+int script_spawn(ScriptTask* tasks, int count, ScriptId script, int target, uint32 tick);
+void script_run(ScriptTask* tasks, int count, ScriptContext* ctx);
+bool script_divers(ScriptTask* task, ScriptContext* ctx);
+bool script_dive(ScriptTask* task, ScriptContext* ctx);
+bool script_shift(ScriptTask* task, ScriptContext* ctx);
+bool script_ufo(ScriptTask* task, ScriptContext* ctx);
+bool script_ufo_pass(ScriptTask* task, ScriptContext* ctx);
+bool script_bench(ScriptTask* task, ScriptContext* ctx);
+void swarm_rebuild(SwarmIndex* self, InvaderState* invaders);
+void swarm_refresh_bounds(SwarmIndex* self, InvaderState* invaders);
+void swarm_remove(SwarmIndex* self, InvaderState* invaders, int index);
+void swarm_translate(SwarmIndex* self, fixed dx, fixed dy);
+int swarm_shooter(SwarmIndex* self, int column);
+bool swarm_may_hit(SwarmIndex* self, Rect* rect);
+void shield_reset(ShieldState* self, int index);
+void shield_damage(ShieldState* self, int32* indices, int32 count);
+Sprite shield_sprite(ShieldState* self);
 
 void input_reset(InputState* self);
 void input_update(InputState* self);
@@ -400,96 +1501,402 @@ bool input_get_key(InputState* self, int scancode);
 bool input_get_down(InputState* self, int scancode);
 bool input_get_up(InputState* self, int scancode);
 
-float32 range_rand(Range* range);
+void rng_seed(Rng* self, uint32 seed);
+uint32 rng_next(Rng* self);
+
+bool arena_init(Arena* self, size_t capacity);
+void arena_free(Arena* self);
+void* arena_push(Arena* self, size_t size);
+void arena_reset(Arena* self);
+size_t arena_mark(Arena* self);
+void arena_release(Arena* self, size_t mark);
+fixed range_rand(Range* range, Rng* rng);
+uint64 hash_mix(uint64 hash, uint32 value);
+uint64 hash_rect(uint64 hash, Rect* rect);
+uint64 play_hash(PlayState* self);
 void bounds_grow(Bounds* self, Point* point);
 Bounds bounds_from_rect(Rect* rect);
 IBounds ibounds_from_rect(Rect* rect);
 void ibounds_extract_union(IBounds* a, IBounds* b, IBounds* dest);
 Rect rect_from_bounds(Bounds* bounds);
 bool rect_intersects(Rect* a, Rect* b);
-bool px_to_px_intersect(Rect* a, Rect* b, PaletteTexture* texA, PaletteTexture* texB, PxCollisionData* data);
+void bounds_batch_set(BoundsBatch* self, int index, const Bounds* bounds);
+void bounds_batch_clear(BoundsBatch* self, int index);
+void bounds_batch_translate(BoundsBatch* self, int count, fixed dx, fixed dy);
+uint64 bounds_overlap_mask(const Bounds* query, const BoundsBatch* batch, int count);
+int bit_lowest(uint64 mask);
+int bit_highest(uint32 value);
+bool px_to_px_intersect(Rect* a, Rect* b, const Sprite* spriteA, const Sprite* spriteB, PxCollisionData* data);
+bool sweep_vertical(Rect* target, Rect* from, Rect* to, fixed* distance);
+int32 px_sweep_vertical(Rect* a, const Sprite* spriteA, Rect* from, Rect* to, const Sprite* spriteB, PxCollisionData* data);
 void rect_to_sdl(Rect* rect, SDL_Rect* dest);
-float32 lerp(float32 a, float32 b, float32 t);
-float32 clamp(float32 v, float32 min, float32 max);
-float32 clamp01(float32 v);
-float32 clamp_range(float32 v, Range* range);
-float32 lerp_range(Range* range, float32 t);
-float32 lerp_clamp_range(Range* range, float32 t);
-
-PaletteTexture create_palette_image_texture(SDL_Renderer* renderer, uint8* data, int width, int height, SDL_Color* palette);
-
-PaletteTexture g_textures[MAX_TEXTURES] = { 0 };
+fixed fx_from_int(int32 v);
+int32 fx_to_int(fixed v);
+float32 fx_to_float(fixed v);
+fixed fx_mul(fixed a, fixed b);
+fixed fx_div(fixed a, fixed b);
+fixed fx_abs(fixed v);
+fixed lerp(fixed a, fixed b, fixed t);
+fixed clamp(fixed v, fixed min, fixed max);
+fixed clamp01(fixed v);
+fixed clamp_range(fixed v, Range* range);
+fixed lerp_range(Range* range, fixed t);
+fixed lerp_clamp_range(Range* range, fixed t);
+
+void event_push(EventList* self, GameEventType type, Point position, int param);
+
+int text_width(const char* text);
+void text_rasterize(uint8* pixels, int width, int height, int x, int y, const char* text, uint8 color);
+bool text_run_stale(TextRun* self, int64 value);
+void text_run_build(TextRun* self, int64 value, const char* text);
+void text_run_draw(TextRun* self, SDL_Renderer* renderer, SDL_Texture* atlas, int x, int y);
+void hud_frame_time(Hud* self, uint64 ns, int particles);
+void hud_render(Hud* self, SDL_Renderer* renderer, SDL_Texture* atlas, PlayState* play);
+void hud_render_debug(Hud* self, SDL_Renderer* renderer, SDL_Texture* atlas, PlayState* play);
+
+void particles_init(ParticlePool* self, uint32 seed);
+void particles_burst(ParticlePool* self, float32 x, float32 y, int count, float32 speed, float32 life, uint8 color);
+void particles_post_events(ParticlePool* self, EventList* events);
+void particles_update(ParticlePool* self, JobSystem* jobs, float32 dt);
+void particles_integrate(ParticlePool* self, int begin, int end, float32 dt);
+void particles_integrate_job(void* data, int begin, int end);
+void particles_compact(ParticlePool* self);
+void particles_render(ParticlePool* self, SDL_Renderer* renderer, const SDL_Color* palette);
+void hud_rasterize(PlayState* play, uint8* pixels);
+
+JobSystem* job_system_create(int workerCount);
+void job_system_destroy(JobSystem* self);
+void job_parallel_for(JobSystem* self, int count, int grain, JobFunc func, void* data);
+void job_execute(JobSystem* self, int thread, Job job);
+bool job_find(JobSystem* self, int thread, Job* out);
+bool job_deque_push(JobDeque* self, const Job* job);
+bool job_deque_pop(JobDeque* self, Job* out);
+bool job_deque_steal(JobDeque* self, Job* out);
+int job_worker(void* data);
+
+void options_parse(Options* self, int argc, char* argv[]);
+
+bool display_init(Display* self, SDL_Window* window, Options* options);
+void display_shutdown(Display* self);
+void display_begin_frame(Display* self);
+void display_present(Display* self);
+void display_present_software(Display* self);
+void display_expand_row(uint32* dst, const uint32* src, int width, int scale);
+void display_darken_row(uint32* dst, const uint32* src, int width);
+
+void frame_rasterize(GameState* state, uint8* pixels);
+void frame_blit(uint8* pixels, const Sprite* sprite, Rect* rect);
+int xor_rle_encode(const uint8* curr, const uint8* prev, int size, uint8* out);
+uint8* write_varint(uint8* out, uint32 value);
+const uint8* read_varint(const uint8* in, const uint8* end, uint32* value);
+void put_u16(uint8* out, uint16 v);
+void put_u32(uint8* out, uint32 v);
+uint16 get_u16(const uint8* in);
+uint32 get_u32(const uint8* in);
+bool xor_rle_decode(const uint8* in, int inSize, uint8* buffer, int size);
+
+CaptureState* capture_start(const char* path);
+void capture_stop(CaptureState* self);
+void capture_frame(CaptureState* self, GameState* state);
+void capture_skip(CaptureState* self);
+int capture_writer(void* data);
+int capture_decode(const char* path, const char* outputPrefix);
+SDL_Surface* frame_surface_create(const SDL_Color* colors, int colorCount);
+void frame_save(SDL_Surface* surface, const uint8* pixels, const char* path);
+
+int soak_run(Options* options);
+int soak_worker(void* data);
+void soak_session_start(SoakSession* self, uint32 seed);
+const char* soak_session_step(SoakSession* self);
+int soak_bot_input(Rng* rng, int* move, PlayState* play, InputState* input, uint8* remoteButtons);
+
+uint8 input_tick_buttons(InputState* input, uint8 remoteButtons);
+void input_apply_tick_buttons(InputState* input, uint8* remoteButtons, uint8 buttons);
+Recording* recording_create(const char* path, uint32 seed, Config* config, const PlayState* start, uint8 startButtons);
+Recording* recording_open(const char* path, uint32* seed, Config* config);
+void recording_close(Recording* self);
+void recording_write(Recording* self, uint8 buttons, int kill);
+bool recording_read(Recording* self, uint8* buttons, int* kill);
+int turbo_batch(TurboState* self, uint64 frameNs, uint64* accumulator, uint64 tickNs);
+void turbo_measure(TurboState* self, int ticks, uint64 frameNs, uint64 simNs, uint64 drawNs, uint64 tickNs);
+History* history_create(int seconds);
+void history_destroy(History* self);
+void history_record(History* self, PlayState* play);
+bool history_restore(History* self, uint32 tick, PlayState* out);
+void history_evict(History* self);
+void histogram_add(Histogram* self, uint32 value);
+uint32 histogram_percentile(Histogram* self, float64 percentile);
+void frame_stats_add(FrameStats* self, const uint64* stageNs);
+void frame_stats_report(FrameStats* self);
+HitchRecorder* hitch_recorder_start(const char* directory, uint32 seed, uint32 tick);
+void hitch_recorder_stop(HitchRecorder* self);
+void hitch_recorder_tick(HitchRecorder* self, PlayState* play, Config* config, uint8 buttons, int kill);
+void hitch_recorder_trigger(HitchRecorder* self, uint32 tick);
+void hitch_recorder_save(HitchRecorder* self, Config* config);
+int hitch_writer(void* data);
+int replay_render_run(Options* options);
+void replay_render_step(ReplayRender* self, Session* session, uint32 tick);
+void replay_render_segments(void* data, int begin, int end);
+int script_bench_run(Options* options);
+int jobs_bench_run(Options* options);
+
+bool net_startup(void);
+void net_shutdown(void);
+void net_socket_close(NetSocket socket);
+bool net_resolve(const char* address, uint16 defaultPort, struct sockaddr_in* out);
+bool net_link_open(NetLink* self, uint16 port, Options* options);
+void net_link_close(NetLink* self);
+void net_link_send(NetLink* self, const struct sockaddr_in* to, const uint8* data, int size, uint64 nowMs);
+void net_link_pump(NetLink* self, uint64 nowMs);
+int net_link_receive(NetLink* self, struct sockaddr_in* from, uint8* data, int capacity);
+void net_snapshot_capture(NetSnapshot* self, PlayState* play, Config* config);
+void mask_pack_bits(const uint8* values, int count, uint8* bits);
+void net_snapshot_pack(const NetSnapshot* self, uint8* out);
+void net_snapshot_unpack(NetSnapshot* self, const uint8* in);
+void net_snapshot_lerp(NetSnapshot* out, const NetSnapshot* a, const NetSnapshot* b, int32 t);
+void net_snapshot_apply(const NetSnapshot* self, PlayState* view, Config* config, fixed dt);
+bool net_server_start(NetServer* self, Options* options);
+void net_server_stop(NetServer* self);
+void net_server_receive(NetServer* self, uint64 nowMs);
+uint8 net_server_player_buttons(NetServer* self);
+void net_server_send(NetServer* self, PlayState* play, Config* config, uint64 nowMs);
+bool net_client_start(NetClient* self, Options* options);
+void net_client_stop(NetClient* self);
+int net_client_receive(NetClient* self, uint32* decoded, int capacity);
+void net_client_send_input(NetClient* self, uint8 buttons, uint64 nowMs);
+bool net_client_view(NetClient* self, float64 elapsedTicks, NetSnapshot* out);
+int net_client_run(Options* options, Display* display, Game* game, AudioState* audio);
+int net_loopback_run(Options* options);
+bool net_loopback_play(NetServer* server, NetClient* client, SoakSession* host, Session* view, Options* options);
+
+FeedState* feed_start(const char* name, bool owner);
+void feed_stop(FeedState* self);
+void feed_publish(FeedState* self, PlayState* play, Config* config);
+bool feed_read(FeedState* self, uint32 tick, uint8* out);
+int feed_monitor_run(Options* options);
+
+bool audio_init(AudioState* self);
+void audio_shutdown(AudioState* self);
+bool audio_play(AudioState* self, SoundId sound);
+bool audio_stop(AudioState* self, SoundId sound);
+void audio_post_events(AudioState* self, EventList* events);
+void audio_callback(void* userdata, uint8* stream, int len);
+bool audio_queue_push(AudioQueue* self, AudioCommand command);
+bool audio_queue_pop(AudioQueue* self, AudioCommand* command);
+void voice_start(Voice* self, SoundId sound, int sampleRate);
+void voice_mix(Voice* self, int32* accum, int count);
+
+bool atlas_packer_place(AtlasPacker* self, int width, int height, SDL_Rect* rect);
+uint32 sprite_atlas_pixel(SDL_Color c);
+bool sprite_atlas_bake(SpriteAtlas* self, const SDL_Color* palette);
+int sprite_atlas_write(const SpriteAtlas* self, const char* path);
+void sprite_mask_rows(const uint8* data, int width, int height, uint32* mask);
 
 void configure(Config* config) {
-    config->tankSpeed = 50.f;
-    config->tankBulletSpeed = 350.f;
-    config->tankFireOffset.x = 0;
-    config->tankFireOffset.y = -4;
-
-    config->invaderMoveDelay.min = 0.01f;
-    config->invaderMoveDelay.max = 1.0f;
-    config->invaderRowDelay.min = 0.f;
-    config->invaderRowDelay.max = 0.2f;
-    config->invaderFireDelay.min = 2.0f;
-    config->invaderFireDelay.max = 6.0f;
-    config->invaderMoveAmount = 4;
-    config->invaderBulletSpeed = 150.f;
-    config->invaderDeathTime = 0.5f;
-}
-
-void rebuild_textures(SDL_Renderer* renderer, PaletteTexture* textures, size_t count, SDL_Color* palette) {
-    for (int i = 0; i < count; ++i) {
-        if (textures[i].texture != NULL) {
-            SDL_DestroyTexture(textures[i].texture);
-        }
-    }
-
-    int texidx = 0;
-    textures[texidx++] = create_palette_image_texture(renderer, cTankImageData, 13, 8, palette);                    // 00
-    textures[texidx++] = create_palette_image_texture(renderer, cInvader1Frame1ImageData, 12, 8, palette);          // 01
-    textures[texidx++] = create_palette_image_texture(renderer, cInvader1Frame2ImageData, 12, 8, palette);          // 02
-    textures[texidx++] = create_palette_image_texture(renderer, cInvader2Frame1ImageData, 13, 8, palette);          // 03
-    textures[texidx++] = create_palette_image_texture(renderer, cInvader2Frame2ImageData, 13, 8, palette);          // 04
-    textures[texidx++] = create_palette_image_texture(renderer, cInvader3Frame1ImageData, 8, 8, palette);           // 05
-    textures[texidx++] = create_palette_image_texture(renderer, cInvader3Frame2ImageData, 8, 8, palette);           // 06
-    textures[texidx++] = create_palette_image_texture(renderer, cUfoImageData, 16, 7, palette);                     // 07
-    textures[texidx++] = create_palette_image_texture(renderer, cTankBulletImageData, 1, 3, palette);               // 08
-    textures[texidx++] = create_palette_image_texture(renderer, cInvaderBulletFrame1ImageData, 3, 5, palette);      // 09
-    textures[texidx++] = create_palette_image_texture(renderer, cInvaderBulletFrame2ImageData, 3, 5, palette);      // 10
-    textures[texidx++] = create_palette_image_texture(renderer, cExplosionImageData, 13, 8, palette);               // 11
-    textures[texidx++] = create_palette_image_texture(renderer, cShieldImageData, 18, 14, palette);                 // 12
+    config->tankSpeed = FX(50);
+    config->tankBulletSpeed = FX(350);
+    config->tankFireOffset.x = FX(0);
+    config->tankFireOffset.y = FX(-4);
+
+    config->invaderMoveDelay.min = FX(0.01);
+    config->invaderMoveDelay.max = FX(1.0);
+    config->invaderRowDelay.min = FX(0);
+    config->invaderRowDelay.max = FX(0.2);
+    config->invaderFireDelay.min = FX(2.0);
+    config->invaderFireDelay.max = FX(6.0);
+    config->invaderMoveAmount = FX(4);
+    config->invaderBulletSpeed = FX(150);
+    config->invaderDeathTime = FX(0.5);
+    config->tankLives = 3;
+    config->tankRespawnTime = FX(1.5);
+    config->versus = false;
+    config->versusAimDelay = FX(0.12);
+    config->versusFireDelay = FX(0.6);
+    config->diveDelay.min = FX(3.0);
+    config->diveDelay.max = FX(8.0);
+    config->diveSpeed = FX(60);
+    config->diveMaxDepth = FX(96);
+    config->ufoDelay.min = FX(15.0);
+    config->ufoDelay.max = FX(30.0);
+    config->ufoSpeed = FX(40);
+    config->stress = false;
 }
 
 int main(int argc, char* argv[]) {
-    configure(&g_config);
+#ifndef VASION_BAKED_SPRITES
+    if (!sprite_atlas_bake(&cSpriteAtlas, cColorPalette)) {
+        return 1;
+    }
+#endif
+
+    Options options;
+    options_parse(&options, argc, argv);
+
+    if (options.bakeSpritesPath) {
+        return sprite_atlas_write(&cSpriteAtlas, options.bakeSpritesPath);
+    }
 
-    srand(time(NULL));
+    if (options.decodeInputPath) {
+        return capture_decode(options.decodeInputPath, options.decodeOutputPrefix);
+    }
+    if (options.soakSeconds > 0 || options.soakRepro) {
+        return soak_run(&options);
+    }
+    if (options.netLoopbackSeconds > 0) {
+        return net_loopback_run(&options);
+    }
+    if (options.feedReadName) {
+        return feed_monitor_run(&options);
+    }
+    if (options.scriptBenchTasks > 0) {
+        return script_bench_run(&options);
+    }
+    if (options.jobsBenchTicks > 0) {
+        return jobs_bench_run(&options);
+    }
+    if (options.renderInputPath) {
+        return replay_render_run(&options);
+    }
+    if ((options.serverPort || options.connectAddress) && !net_startup()) {
+        return 1;
+    }
 
     SDL_Window* window = SDL_CreateWindow("Vasion", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 1080, 720, SDL_WINDOW_RESIZABLE);
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
 
-    SDL_Texture* screenTexture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, cScreenWidth, cScreenHeight);
+    Display display;
+    if (!display_init(&display, window, &options)) {
+        SDL_Log("failed to create renderer: %s", SDL_GetError());
+        SDL_DestroyWindow(window);
+        return 1;
+    }
 
-    SDL_RenderSetLogicalSize(renderer, cScreenWidth, cScreenHeight);
+    Session* session = (Session*)calloc(1, sizeof(Session));
+    session_init(session, options.seed);
+    session->config.versus = options.serverPort || options.connectAddress;
+    GameState* state = &session->state;
+    if (options.stress) {
+        session->config.stress = true;
+        play_reset(&state->play, &session->config);
+    }
 
-    rebuild_textures(renderer, g_textures, MAX_TEXTURES, cColorPalette);
+    // a replay starts over from the seed and mode it was recorded with
+    uint32 seed = options.seed;
+    Recording* replay = NULL;
+    if (options.replayPath && !options.serverPort && !options.connectAddress) {
+        Config recorded = session->config;
+        replay = recording_open(options.replayPath, &seed, &recorded);
+        if (replay) {
+            session_init(session, seed);
+            session->config.versus = recorded.versus;
+            session->config.stress = recorded.stress;
+            if (replay->start) {
+                // a saved hitch, picks up mid game with the keys that were held
+                state->play = *replay->start;
+                input_apply_tick_buttons(&state->input, &state->remoteButtons, replay->startButtons);
+                input_update(&state->input);
+            }
+            else if (recorded.stress) {
+                play_reset(&state->play, &session->config);
+            }
+        }
+    }
+    Recording* record = NULL;
+    if (options.recordPath) {
+        record = recording_create(options.recordPath, seed, &session->config, NULL, 0);
+    }
 
-    GameState gameState;
+    // --jobs counts this thread too. A normal game's bullets and particles are
+    // less work than handing them out, so it runs inline unless asked.
+    int jobThreads = options.jobThreads > 0 ? options.jobThreads : 1;
+    session->jobs = job_system_create(jobThreads - 1);
 
     Game game;
-    game.window = window;
-    game.renderer = renderer;
-    game.gameState = &gameState;
+    game_init(&game, window, display.renderer, session);
+
+    // optional work only gets what the display's refresh leaves of a frame
+    {
+        uint64 budgetNs = (uint64)(options.frameBudgetMs * 1e6);
+        SDL_DisplayMode mode;
+        if (options.frameBudgetMs < 0) {
+            int refresh = SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0 ? mode.refresh_rate : 60;
+            budgetNs = 1000000000ull / refresh * FRAME_BUDGET_SHARE / 100;
+        }
+        frame_scheduler_init(&game.scheduler, budgetNs);
+    }
+
+    // the debug kill key draws from its own stream, not the simulation's
+    Rng debugRng;
+    rng_seed(&debugRng, options.seed ^ 0xdeb6u);
+    bool debugKill = false;
+
+    // --bot plays with the soak player, seeded the same way as a soak session
+    Rng botRng;
+    rng_seed(&botRng, seed ^ 0x5bd1e995u);
+    int botMove = 0;
+
+    // fast forward is for watching, a networked game runs in real time
+    TurboState turbo;
+    SDL_memset(&turbo, 0, sizeof(turbo));
+    turbo.enabled = options.turbo && !options.serverPort;
+    turbo.speed = options.turboSpeed;
+    turbo.tickNs = 10000;
+
+    // hold R to go back in time, play carries on from wherever it is let go.
+    // A recording can't follow a jump back, so there is no rewinding one.
+    History* history = NULL;
+    if (options.historySeconds > 0 && !options.serverPort && !options.recordPath) {
+        history = history_create(options.historySeconds);
+    }
+    uint32 rewindFrames = 0;
+    uint32 rewindFrom = 0;
+
+    // tail frame times, F8 reports them. With --hitch-dir, slow frames also
+    // save the seconds around them as a recording that replays the same ticks.
+    FrameStats frameStats;
+    SDL_memset(&frameStats, 0, sizeof(frameStats));
+    frameStats.hitchUs = (uint32)SDL_max(options.hitchMs, 0) * 1000;
+    HitchRecorder* hitch = NULL;
+    if (options.hitchDir && options.hitchMs > 0 && !options.serverPort) {
+        hitch = hitch_recorder_start(options.hitchDir, seed, state->play.tick);
+    }
+    uint32 frames = 0;
+
+    AudioState audio;
+    audio_init(&audio);
+
+    CaptureState* capture = NULL;
+    if (options.capturePath) {
+        capture = capture_start(options.capturePath);
+    }
+
+    FeedState* feed = NULL;
+    if (options.feedName) {
+        feed = feed_start(options.feedName, true);
+    }
 
-    game_init(&game);
+    NetServer* server = NULL;
+    if (options.serverPort) {
+        server = (NetServer*)malloc(sizeof(NetServer));
+        if (!net_server_start(server, &options)) {
+            free(server);
+            server = NULL;
+        }
+    }
 
     uint64 time_prev_ticks = 0;
-    float32 time_dt = 0.f;
+    uint64 time_accumulator = 0;
+    const uint64 time_tick = 1000000000 / SIM_TICK_RATE;
+    uint64 frameNs = 0;
+    int tickCount = 0;
 
+    int result = 0;
     bool isRunning = true;
+    if (options.connectAddress) {
+        // player two only ever draws what the server sends
+        result = net_client_run(&options, &display, &game, &audio);
+        isRunning = false;
+    }
     while (isRunning) {
-        input_update(&gameState.input);
-
         SDL_Event event;
         while (SDL_PollEvent(&event)) {
             switch (event.type) {
@@ -498,89 +1905,325 @@ int main(int argc, char* argv[]) {
                     break;
 
                 case SDL_KEYDOWN:
-                    input_set_key(&gameState.input, event.key.keysym.scancode, true);
+                    input_set_key(&state->input, event.key.keysym.scancode, true);
+
+                    if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
+                        isRunning = false;
+                    }
+
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F2) {
+                        display.scanlines = !display.scanlines;
+                    }
+
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F4) {
+                        game.hud.showDebug = !game.hud.showDebug;
+                    }
+
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F5) {
+                        // particle stress burst
+                        particles_burst(game.particles, cScreenWidth / 2.f, cScreenHeight / 2.f, 20000, 90.f, 3.f, 1);
+                    }
+
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F3) {
+                        SDL_Log("tick %u hash %016llx", state->play.tick, (unsigned long long)play_hash(&state->play));
+                    }
+
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F6 && !server) {
+                        turbo.enabled = !turbo.enabled;
+                        time_accumulator = 0;
+                        audio_stop(&audio, Sound_Ufo);
+                    }
+
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F8) {
+                        frame_stats_report(&frameStats);
+                        frame_scheduler_report(&game.scheduler);
+                    }
+
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F7) {
+                        // 10x, 100x, as fast as it goes
+                        turbo.speed = turbo.speed == 10 ? 100 : turbo.speed == 100 ? 0 : 10;
+                    }
 
                     if (event.key.keysym.scancode == SDL_SCANCODE_D) {
-                        int index = rand() % MAX_INVADERS;
-                        while (!gameState.play.invaders[index].active) {
-                            index = rand() % MAX_INVADERS;
-                        }
-                        gameState.play.invaders[index].active = false;
+                        // applied on the next tick so recordings see it
+                        debugKill = true;
                     }
                     break;
 
                 case SDL_KEYUP:
-                    input_set_key(&gameState.input, event.key.keysym.scancode, false);
+                    input_set_key(&state->input, event.key.keysym.scancode, false);
                     break;
             }
         }
 
-        if (input_get_down(&gameState.input, SDL_SCANCODE_ESCAPE)) {
-            isRunning = false;
-        }
-
+        uint64 frameStart = SDL_GetPerformanceCounter();
         {
-            uint64 ticks = SDL_GetPerformanceCounter();
+            uint64 ticks = frameStart;
             uint64 frequency = SDL_GetPerformanceFrequency();
 
             if (time_prev_ticks == 0) {
                 time_prev_ticks = ticks;
             }
 
-            uint64 diff = (ticks - time_prev_ticks) * 1000000000 / frequency;
+            frameNs = (ticks - time_prev_ticks) * 1000000000 / frequency;
             time_prev_ticks = ticks;
+            frames++;
+
+            if (frameStats.hitchUs > 0 && !turbo.enabled && rewindFrames == 0 && frames > HITCH_WARMUP_FRAMES &&
+                frameNs > (uint64)frameStats.hitchUs * 1000) {
+                frameStats.hitches++;
+                SDL_Log("hitch: %.2fms frame before tick %u (update %.2fms render %.2fms present %.2fms)",
+                    frameNs / 1e6, state->play.tick, frameStats.last[FrameStage_Update] / 1000.0,
+                    frameStats.last[FrameStage_Render] / 1000.0, frameStats.last[FrameStage_Present] / 1000.0);
+                if (hitch) {
+                    hitch_recorder_trigger(hitch, state->play.tick);
+                }
+            }
+            hud_frame_time(&game.hud, frameNs, game.particles->count);
+
+            if (history && input_get_key(&state->input, SDL_SCANCODE_R)) {
+                // scrubbing back pauses play, faster the longer it is held
+                if (rewindFrames == 0) {
+                    rewindFrom = state->play.tick;
+                    audio_stop(&audio, Sound_Ufo);
+                    if (replay) {
+                        SDL_Log("replay: left at tick %u to rewind", state->play.tick);
+                        recording_close(replay);
+                        replay = NULL;
+                    }
+                }
+                uint32 step = SDL_min(1u << SDL_min(rewindFrames / SIM_TICK_RATE, 6), HISTORY_MAX_REWIND_STEP);
+                uint32 oldest = history->count > 0 ? history->firstTick : state->play.tick;
+                uint32 target = state->play.tick - SDL_min(step, state->play.tick - oldest);
+                if (target != state->play.tick) {
+                    history_restore(history, target, &state->play);
+                }
+                rewindFrames++;
+                time_accumulator = 0;
+                tickCount = 0;
+            }
+            else if (turbo.enabled) {
+                rewindFrames = 0;
+                tickCount = turbo_batch(&turbo, frameNs, &time_accumulator, time_tick);
+            }
+            else {
+                rewindFrames = 0;
+                // don't try to catch up on long stalls (debugger, window drag)
+                time_accumulator += frameNs;
+                if (time_accumulator > time_tick * MAX_SIM_TICKS_PER_FRAME) {
+                    time_accumulator = time_tick * MAX_SIM_TICKS_PER_FRAME;
+                }
+                tickCount = (int)(time_accumulator / time_tick);
+                time_accumulator -= tickCount * time_tick;
+            }
+        }
 
-            time_dt = (float32)diff / 1000000000.f;
+        uint64 nowMs = SDL_GetTicks();
+        if (server) {
+            net_server_receive(server, nowMs);
         }
 
-        game_update(&game, time_dt);
+        // the simulation only ever advances in whole fixed ticks
+        uint64 simStart = SDL_GetPerformanceCounter();
+        for (int i = 0; i < tickCount; ++i) {
+            if (server) {
+                state->remoteButtons = net_server_player_buttons(server);
+            }
 
-        // render to the render texture
-        {
-            SDL_SetRenderTarget(renderer, screenTexture);
-            SDL_SetRenderDrawColor(renderer, 32, 32, 48, 255);
-            SDL_RenderClear(renderer);
+            int kill = -1;
+            if (replay) {
+                uint8 buttons;
+                if (recording_read(replay, &buttons, &kill)) {
+                    input_apply_tick_buttons(&state->input, &state->remoteButtons, buttons);
+                }
+                else {
+                    SDL_Log("replay: ended after %u ticks, hash %016llx", replay->ticks, (unsigned long long)play_hash(&state->play));
+                    recording_close(replay);
+                    replay = NULL;
+                    kill = -1;
+                }
+            }
+            else if (options.bot) {
+                // a served game's player two is whoever is connected
+                kill = soak_bot_input(&botRng, &botMove, &state->play, &state->input, server ? NULL : &state->remoteButtons);
+            }
+            if (!replay && debugKill && state->play.swarm.aliveCount > 0) {
+                kill = rng_next(&debugRng) % MAX_INVADERS;
+                while (!state->play.invaders[kill].active) {
+                    kill = rng_next(&debugRng) % MAX_INVADERS;
+                }
+            }
+            debugKill = false;
+            if (hitch) {
+                hitch_recorder_tick(hitch, &state->play, &session->config,
+                    input_tick_buttons(&state->input, state->remoteButtons), kill);
+            }
+            if (kill >= 0) {
+                invader_kill(&state->play, &session->config, kill);
+            }
+            if (record) {
+                recording_write(record, input_tick_buttons(&state->input, state->remoteButtons), kill);
+            }
+
+            session_update(session, SIM_TICK_DT);
+            if (history) {
+                history_record(history, &state->play);
+            }
+            if (server) {
+                net_server_send(server, &state->play, &session->config, nowMs);
+            }
+            if (feed) {
+                feed_publish(feed, &state->play, &session->config);
+            }
+            // a fast forwarded batch only shows its last frame, skip its sounds and effects
+            if (!turbo.enabled) {
+                audio_post_events(&audio, &state->play.events);
+                particles_post_events(game.particles, &state->play.events);
+            }
+            input_update(&state->input);
+        }
+        if (server) {
+            net_link_pump(&server->link, nowMs);
+        }
 
-            game_render(&game);
+        // the must-do work is in, optional work gets the rest of the budget
+        uint32 wanted = 1u << FrameTask_Shields | 1u << FrameTask_ParticleDraw | 1u << FrameTask_Particles;
+        wanted |= game.hud.showDebug ? 1u << FrameTask_Hud : 0;
+        wanted |= capture ? 1u << FrameTask_Capture : 0;
+        frame_scheduler_plan(&game.scheduler, frameStart, wanted);
+        game_update_particles(&game, session->jobs, frameNs / 1e9f);
+
+        uint64 drawStart = SDL_GetPerformanceCounter();
+        game.hud.turboSpeed = turbo.enabled && rewindFrames == 0 ? SDL_max(turbo.achievedSpeed, 1) : 0;
+        game.hud.rewindTicks = rewindFrames > 0 ? SDL_max(rewindFrom - state->play.tick, 1) : 0;
+        display_begin_frame(&display);
+        game_render(&game);
+        uint64 presentStart = SDL_GetPerformanceCounter();
+        display_present(&display);
+        uint64 presentEnd = SDL_GetPerformanceCounter();
+
+        if (capture) {
+            if (frame_scheduler_begin(&game.scheduler, FrameTask_Capture)) {
+                capture_frame(capture, state);
+                frame_scheduler_end(&game.scheduler, FrameTask_Capture);
+            }
+            else {
+                capture_skip(capture);
+            }
         }
 
-        // render the render texture to the window
         {
-            SDL_SetRenderTarget(renderer, NULL);
-
-            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-            //SDL_RenderClear(renderer);
-            SDL_RenderCopy(renderer, screenTexture, NULL, NULL);
-
-            SDL_RenderPresent(renderer);
+            uint64 frequency = SDL_GetPerformanceFrequency();
+            uint64 stageNs[FrameStage_Count] = {
+                frameNs,
+                (drawStart - simStart) * 1000000000 / frequency,
+                (presentStart - drawStart) * 1000000000 / frequency,
+                (presentEnd - presentStart) * 1000000000 / frequency,
+            };
+            if (turbo.enabled) {
+                turbo_measure(&turbo, tickCount, frameNs, stageNs[FrameStage_Update],
+                    stageNs[FrameStage_Render] + stageNs[FrameStage_Present], time_tick);
+            }
+            else if (rewindFrames == 0 && frames > HITCH_WARMUP_FRAMES) {
+                frame_stats_add(&frameStats, stageNs);
+            }
         }
     }
 
-    SDL_DestroyRenderer(renderer);
+    if (frameStats.stages[FrameStage_Frame].total > 0) {
+        frame_stats_report(&frameStats);
+        frame_scheduler_report(&game.scheduler);
+    }
+    if (hitch) {
+        hitch_recorder_stop(hitch);
+    }
+
+    if (history) {
+        history_destroy(history);
+    }
+    if (replay) {
+        recording_close(replay);
+    }
+    if (record) {
+        SDL_Log("record: %u ticks, hash %016llx", record->ticks, (unsigned long long)play_hash(&state->play));
+        recording_close(record);
+    }
+    if (capture) {
+        capture_stop(capture);
+    }
+    if (server) {
+        net_server_stop(server);
+        free(server);
+    }
+    if (feed) {
+        feed_stop(feed);
+    }
+    if (session->jobs) {
+        job_system_destroy(session->jobs);
+    }
+    if (options.serverPort || options.connectAddress) {
+        net_shutdown();
+    }
+    audio_shutdown(&audio);
+    game_shutdown(&game);
+    session_free(session);
+    free(session);
+    display_shutdown(&display);
     SDL_DestroyWindow(window);
 
-    return 0;
+    return result;
 }
 
-void game_init(Game* self) {
-    GameState* state = self->gameState;
-    for (int i = 0; i < MAX_SHIELDS; ++i) {
-        state->play.shields[i].texture.texture = NULL;
-        state->play.shields[i].texture.data = NULL;
+// Sessions must start zeroed (calloc) the first time, after that this
+// restarts them in place without touching the heap
+void session_init(Session* self, uint32 seed) {
+    Arena arena = self->arena;
+    SDL_memset(self, 0, sizeof(*self));
+    if (!arena.base) {
+        arena_init(&arena, SESSION_ARENA_BYTES);
     }
-
-    play_reset(&state->play);
+    arena_reset(&arena);
+    self->arena = arena;
+    configure(&self->config);
+
+    GameState* state = &self->state;
+    rng_seed(&state->play.rng, seed);
+    state->play.tick = 0;
+    play_reset(&state->play, &self->config);
     input_reset(&state->input);
 }
 
-void game_update(Game* self, float32 dt) {
-    GameState* state = self->gameState;
+void session_free(Session* self) {
+    arena_free(&self->arena);
+}
+
+void session_update(Session* self, fixed dt) {
+    Config* config = &self->config;
+    GameState* state = &self->state;
     InputState* input = &state->input;
+    size_t scratch = arena_mark(&self->arena);
+
+    state->play.events.count = 0;
+    state->play.events.mask = 0;
+    state->play.tick++;
 
     // Tank Movement
     TankState* tank = &state->play.tank;
-    {
-        float32 speed = g_config.tankSpeed * dt;
+    if (tank->mode == TankMode_Dead) {
+        tank->respawnDelay -= dt;
+        if (tank->respawnDelay <= 0) {
+            if (state->play.lives > 0) {
+                tank->mode = TankMode_Active;
+                tank->target.position.x = fx_from_int(cScreenWidth / 2);
+            }
+            else {
+                // game over, straight into a new game
+                play_reset(&state->play, config);
+            }
+        }
+    }
+    else {
+        fixed speed = fx_mul(config->tankSpeed, dt);
         if (input_get_key(input, KEY_LEFT)) {
             tank->target.position.x -= speed;
         }
@@ -588,11 +2231,11 @@ void game_update(Game* self, float32 dt) {
             tank->target.position.x += speed;
         }
 
-        float leftBound = tank->target.width / 2;
+        fixed leftBound = tank->target.width / 2;
         if (tank->target.position.x < leftBound) {
             tank->target.position.x = leftBound;
         }
-        float rightBound = cScreenWidth - tank->target.width / 2;
+        fixed rightBound = fx_from_int(cScreenWidth) - tank->target.width / 2;
         if (tank->target.position.x > rightBound) {
             tank->target.position.x = rightBound;
         }
@@ -600,50 +2243,29 @@ void game_update(Game* self, float32 dt) {
 
     // Tank Shooting
     {
-        bool requestShot = input_get_down(input, KEY_FIRE);
+        bool requestShot = tank->mode == TankMode_Active && input_get_down(input, KEY_FIRE);
         if (requestShot) {
-            BulletState* bullet = NULL;
-            int handle = 0;
-            for (int i = 0; i < MAX_TANK_BULLETS; ++i) {
-                if (tank->bullets[i] < 0) {
-                    for (int j = 0; j < MAX_BULLETS; ++j) {
-                        if (!state->play.bullets[j].active) {
-                            tank->bullets[i] = j;
-                            bullet = &state->play.bullets[j];
-                        }
-                    }
-                    handle = i;
-                    break;
-                }
-            }
-
-            if (bullet) {
+            int index = bullet_alloc(&state->play, BULLET_OWNER_TANK);
+            if (index >= 0) {
+                BulletState* bullet = &state->play.bullets[index];
                 bullet_create(bullet,
-                    tank->target.position.x + g_config.tankFireOffset.x,
-                    tank->target.position.y + g_config.tankFireOffset.y,
+                    fx_to_int(tank->target.position.x + config->tankFireOffset.x),
+                    fx_to_int(tank->target.position.y + config->tankFireOffset.y),
                     0,
-                    &tank->bullets[handle]);
+                    bullet->owner,
+                    bullet->ownerSlot);
+                event_push(&state->play.events, GameEvent_TankShot, tank->target.position, 0);
             }
         }
     }
 
     // Invaders
     {
+        SwarmIndex* swarm = &state->play.swarm;
         state->play.moveDelay -= dt;
 
-        // figure out boundaries of entire swarm
-        int aliveInvaders = 0;
-        Bounds invaderBounds = { 999999, -999999, 999999, -999999 };
-        for (int i = 0; i < MAX_INVADERS; ++i) {
-            InvaderState* invader = &state->play.invaders[i];
-            if (invader->active) {
-                ++aliveInvaders;
-                bounds_grow(&invaderBounds, &invader->target.position);
-            }
-        }
-
         // time for the next move
-        if (state->play.moveDelay <= 0.f) {
+        if (state->play.moveDelay <= 0) {
             // using previous two moves figure out which move is appropriate
             InvaderMove prevMove1 = state->play.moveQueue[(state->play.moveIndex - 0) % INVADER_MOVE_QUEUE_SIZE];
             InvaderMove prevMove2 = state->play.moveQueue[(state->play.moveIndex - 1) % INVADER_MOVE_QUEUE_SIZE];
@@ -652,13 +2274,13 @@ void game_update(Game* self, float32 dt) {
 
             switch (prevMove1) {
                 case InvaderMove_Right:
-                    if (invaderBounds.right >= INVADER_BOUNDARY_RIGHT) {
+                    if (swarm->aliveCount > 0 && swarm->bounds.right >= fx_from_int(INVADER_BOUNDARY_RIGHT)) {
                         move = InvaderMove_Down;
                     }
                     break;
 
                 case InvaderMove_Left:
-                    if (invaderBounds.left <= INVADER_BOUNDARY_LEFT) {
+                    if (swarm->aliveCount > 0 && swarm->bounds.left <= fx_from_int(INVADER_BOUNDARY_LEFT)) {
                         move = InvaderMove_Down;
                     }
                     break;
@@ -673,141 +2295,241 @@ void game_update(Game* self, float32 dt) {
                     break;
             }
 
-            float32 alivePerc = (float32)aliveInvaders / MAX_INVADERS;
+            fixed alivePerc = swarm->aliveCount * FX_ONE / MAX_INVADERS;
 
             // update move queue and move delay
             state->play.moveIndex++;
             int index = state->play.moveIndex % INVADER_MOVE_QUEUE_SIZE;
             state->play.moveQueue[index] = move;
-            state->play.moveDelay += lerp(g_config.invaderMoveDelay.min, g_config.invaderMoveDelay.max, alivePerc);
+            state->play.moveDelay += lerp(config->invaderMoveDelay.min, config->invaderMoveDelay.max, alivePerc);
+
+            fixed dx = 0, dy = 0;
+            switch (move) {
+                case InvaderMove_Down: dy = config->invaderMoveAmount; break;
+                case InvaderMove_Left: dx = -config->invaderMoveAmount; break;
+                case InvaderMove_Right: dx = config->invaderMoveAmount; break;
+            }
 
             // tell all invaders what their next move is and how long to wait until doing it
             for (int i = 0; i < MAX_INVADERS; ++i) {
                 InvaderState* invader = &state->play.invaders[i];
                 if (invader->active) {
                     invader->frame++;
-                    switch (move) {
-                        case InvaderMove_Down: invader->target.position.y += g_config.invaderMoveAmount; break;
-                        case InvaderMove_Left: invader->target.position.x -= g_config.invaderMoveAmount; break;
-                        case InvaderMove_Right: invader->target.position.x += g_config.invaderMoveAmount; break;
-                    }
+                    invader->target.position.x += dx;
+                    invader->target.position.y += dy;
                 }
             }
+            swarm_translate(swarm, dx, dy);
+            Point swarmCenter = {
+                (swarm->bounds.left + swarm->bounds.right) / 2,
+                (swarm->bounds.top + swarm->bounds.bottom) / 2,
+            };
+            event_push(&state->play.events, GameEvent_InvaderMarch, swarmCenter, state->play.moveIndex);
         }
     }
 
     // Invader bullet firing
-    {
-        for (int i = 0; i < MAX_INVADERS; ++i) {
-            InvaderState* invader = &state->play.invaders[i];
-            if (invader->active) {
-                invader->fireDelay -= dt;
-                if (invader->fireDelay <= 0.f) {
-                    BulletState* bullet = NULL;
-                    int handle = 0;
-                    for (int j = 0; j < MAX_INVADER_BULLETS; ++j) {
-                        if (invader->bullets[i] < 0) {
-                            for (int k = 0; k < MAX_BULLETS; ++k) {
-                                if (!state->play.bullets[k].active) {
-                                    invader->bullets[i] = k;
-                                    bullet = &state->play.bullets[k];
-                                }
-                            }
-                            handle = j;
-                            break;
-                        }
-                    }
-
-                    if (bullet) {
-                        bullet_create(bullet,
-                            invader->target.position.x + 0,
-                            invader->target.position.y + 0,
-                            1,
-                            &invader->bullets[handle]);
-                        invader->fireDelay = range_rand(&g_config.invaderFireDelay);
-                    }
-                }
+    if (config->versus) {
+        versus_update(&state->play, config, state->remoteButtons, dt);
+    }
+    else {
+        // only the lowest alive invader in each column is allowed to shoot
+        SwarmIndex* swarm = &state->play.swarm;
+        for (int col = swarm->leftColumn; col <= swarm->rightColumn; ++col) {
+            int shooter = swarm_shooter(swarm, col);
+            if (shooter < 0) {
+                continue;
             }
-            else {
-                if (invader->deathTime > 0) {
-                    invader->deathTime -= dt;
-                }
+
+            InvaderState* invader = &state->play.invaders[shooter];
+            invader->fireDelay -= dt;
+            if (invader->fireDelay <= 0 && invader_fire(&state->play, shooter)) {
+                invader->fireDelay = range_rand(&config->invaderFireDelay, &state->play.rng);
             }
         }
     }
 
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        InvaderState* invader = &state->play.invaders[i];
+        if (!invader->active && invader->deathTime > 0) {
+            invader->deathTime -= dt;
+        }
+    }
+    if (!state->play.ufo.active && state->play.ufo.deathTime > 0) {
+        state->play.ufo.deathTime -= dt;
+    }
+
     // Bullet updates
     {
+        BulletPhase* phase = (BulletPhase*)arena_push(&self->arena, sizeof(BulletPhase));
+        phase->play = &state->play;
+        phase->config = config;
+        phase->dt = dt;
+        job_parallel_for(self->jobs, MAX_BULLETS, BULLET_JOB_GRAIN, bullet_phase_move, phase);
+
+        uint32 shieldVersions[MAX_SHIELDS];
+        for (int i = 0; i < MAX_SHIELDS; ++i) {
+            shieldVersions[i] = state->play.shields[i].version;
+        }
+
         for (int i = 0; i < MAX_BULLETS; ++i) {
             BulletState* bullet = &state->play.bullets[i];
             if (bullet->active) {
-                bullet->frame++;
-                float32 speed = (bullet->direction > 0) ? g_config.invaderBulletSpeed : g_config.tankBulletSpeed;
-                bullet->target.position.y += speed * bullet->direction * dt;
-                if (bullet->target.position.y < 0 || bullet->target.position.y > cScreenHeight + 4) {
-                    bullet_remove(bullet);
+                // hits only ever take targets away, so a sweep is still right
+                // unless an earlier bullet this tick took the very thing it hit
+                BulletHit hit = phase->hits[i];
+                bool stale =
+                    (hit.type == BulletHit_Invader && !state->play.invaders[hit.index].active) ||
+                    (hit.type == BulletHit_Shield && state->play.shields[hit.index].version != shieldVersions[hit.index]) ||
+                    (hit.type == BulletHit_Tank && state->play.tank.mode != TankMode_Active) ||
+                    (hit.type == BulletHit_Ufo && !state->play.ufo.active);
+                if (stale) {
+                    bullet_sweep(&state->play, bullet, &phase->from[i], &hit);
                 }
 
-                if (bullet->direction < 0) {
-                    for (int j = 0; j < MAX_INVADERS; ++j) {
-                        InvaderState* invader = &state->play.invaders[j];
-                        if (invader->active) {
-                            if (rect_intersects(&bullet->target, &invader->target)) {
-                                bullet_remove(bullet);
-                                invader->active = false;
-                                invader->deathTime = g_config.invaderDeathTime;
-                            }
+                if (hit.type != BulletHit_None) {
+                    bullet_remove(&state->play, bullet);
+                    switch (hit.type) {
+                        case BulletHit_Invader:
+                            invader_kill(&state->play, config, hit.index);
+                            break;
+                        case BulletHit_Shield: {
+                            ShieldState* shield = &state->play.shields[hit.index];
+                            SDL_Rect r;
+                            rect_to_sdl(&shield->target, &r);
+                            Point impact = {
+                                fx_from_int(r.x + hit.pixel % SHIELD_WIDTH),
+                                fx_from_int(r.y + hit.pixel / SHIELD_WIDTH),
+                            };
+                            shield_damage(shield, &hit.pixel, 1);
+                            event_push(&state->play.events, GameEvent_ShieldHit, impact, hit.index);
+                            break;
                         }
+                        case BulletHit_Tank:
+                            tank_kill(&state->play, config);
+                            break;
+                        case BulletHit_Ufo:
+                            ufo_kill(&state->play, config);
+                            break;
+                        default:
+                            break;
                     }
+                    continue;
                 }
-                else if (bullet->direction > 0) {
-                    if (rect_intersects(&bullet->target, &tank->target)) {
-                        bullet_remove(bullet);
-                    }
+
+                if (bullet->target.position.y < 0 || bullet->target.position.y > fx_from_int(cScreenHeight + 4)) {
+                    bullet_remove(&state->play, bullet);
                 }
             }
         }
     }
 
-    // Shield stuff
-    {
-        for (int i = 0; i < MAX_SHIELDS; ++i) {
-            ShieldState* shield = &state->play.shields[i];
-            for (int j = 0; j < MAX_BULLETS; ++j) {
-                BulletState* bullet = &state->play.bullets[j];
-                if (!bullet->active) continue;
-
-                int texIdx = bullet->baseTexture + ((bullet->frame / 30) % bullet->frameCount);
-                PxCollisionData collData;
-                if (px_to_px_intersect(&shield->target,
-                    &bullet->target,
-                    &g_textures[cShieldTexture],
-                    &g_textures[texIdx],
-                    &collData)) {
-                    shield_damage(shield, self, &collData.pixelA, 1);
-                    bullet_remove(bullet);
-                }
-            }
+    play_run_scripts(&state->play, config, dt);
+    play_check_wave_end(&state->play, config);
+    arena_release(&self->arena, scratch);
+}
+
+void game_init(Game* self, SDL_Window* window, SDL_Renderer* renderer, Session* session) {
+    SDL_memset(self, 0, sizeof(*self));
+    self->window = window;
+    self->renderer = renderer;
+    self->session = session;
+
+    // the whole baked atlas goes up in one upload
+    self->atlas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STATIC, ATLAS_WIDTH, ATLAS_HEIGHT);
+    SDL_UpdateTexture(self->atlas, NULL, cSpriteAtlas.pixels, ATLAS_WIDTH * sizeof(uint32));
+    SDL_BlendMode premultiplied = SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        SDL_BLENDOPERATION_ADD, SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+    if (SDL_SetTextureBlendMode(self->atlas, premultiplied) != 0) {
+        // alpha is all or nothing, so plain blending looks the same where custom modes are missing
+        SDL_SetTextureBlendMode(self->atlas, SDL_BLENDMODE_BLEND);
+    }
+
+    self->particles = (ParticlePool*)calloc(1, sizeof(ParticlePool));
+    particles_init(self->particles, session->state.play.rng.state);
+    arena_init(&self->frame, FRAME_ARENA_BYTES);
+    frame_scheduler_init(&self->scheduler, 0);
+
+    // shields change every few hits, so they are streamed into the same textures,
+    // as SDL_Color bytes in memory order whatever the machine's endianness
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        self->shieldTextures[i] = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STREAMING, SHIELD_WIDTH, SHIELD_HEIGHT);
+        SDL_SetTextureBlendMode(self->shieldTextures[i], SDL_BLENDMODE_BLEND);
+        self->shieldVersions[i] = ~session->state.play.shields[i].version;
+    }
+}
+
+void game_shutdown(Game* self) {
+    if (self->atlas) {
+        SDL_DestroyTexture(self->atlas);
+        self->atlas = NULL;
+    }
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        if (self->shieldTextures[i]) {
+            SDL_DestroyTexture(self->shieldTextures[i]);
+            self->shieldTextures[i] = NULL;
+        }
+    }
+    free(self->particles);
+    self->particles = NULL;
+    arena_free(&self->frame);
+}
+
+// Re-uploads the shields whose pixels changed since they were last drawn
+void game_sync_shields(Game* self) {
+    PlayState* play = &self->session->state.play;
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        ShieldState* shield = &play->shields[i];
+        if (self->shieldVersions[i] == shield->version) {
+            continue;
+        }
+        SDL_Color* rgba = (SDL_Color*)arena_push(&self->frame, SHIELD_WIDTH * SHIELD_HEIGHT * sizeof(SDL_Color));
+        for (int j = 0; j < SHIELD_WIDTH * SHIELD_HEIGHT; ++j) {
+            uint8 value = shield->pixels[j];
+            rgba[j] = value > 0 ? cColorPalette[value - 1] : (SDL_Color){ 0, 0, 0, 0 };
         }
+        SDL_UpdateTexture(self->shieldTextures[i], NULL, rgba, SHIELD_WIDTH * sizeof(SDL_Color));
+        self->shieldVersions[i] = shield->version;
+    }
+}
+
+// Integrates particles when the frame has room, otherwise keeps the time for later
+void game_update_particles(Game* self, JobSystem* jobs, float32 dt) {
+    self->particleDt += dt;
+    self->particles->detail = self->scheduler.detail;
+    if (frame_scheduler_begin(&self->scheduler, FrameTask_Particles)) {
+        particles_update(self->particles, jobs, self->particleDt);
+        self->particleDt = 0;
+        frame_scheduler_end(&self->scheduler, FrameTask_Particles);
     }
 }
 
 void game_render(Game* self) {
-    GameState* state = self->gameState;
+    GameState* state = &self->session->state;
     SDL_Renderer* renderer = self->renderer;
+    FrameScheduler* scheduler = &self->scheduler;
+    uint64 start = SDL_GetPerformanceCounter();
+    uint64 optionalNs = scheduler->optionalNs;
+    arena_reset(&self->frame);
+
+    if (frame_scheduler_begin(scheduler, FrameTask_Shields)) {
+        game_sync_shields(self);
+        frame_scheduler_end(scheduler, FrameTask_Shields);
+    }
 
     TankState* tank = &state->play.tank;
     {
         SDL_Rect r;
         rect_to_sdl(&tank->target, &r);
-        SDL_RenderCopy(renderer, g_textures[0].texture, NULL, &r);
+        int texIdx = (tank->mode == TankMode_Dead) ? cExplosionTexture : cTankTexture;
+        SDL_RenderCopy(renderer, self->atlas, &cSpriteAtlas.rects[texIdx], &r);
     }
 
     for (int i = 0; i < MAX_SHIELDS; ++i) {
         ShieldState* shield = &state->play.shields[i];
         SDL_Rect r;
         rect_to_sdl(&shield->target, &r);
-        SDL_RenderCopy(renderer, g_textures[12].texture, NULL, &r);
+        SDL_RenderCopy(renderer, self->shieldTextures[i], NULL, &r);
     }
 
     for (int i = 0; i < MAX_INVADERS; ++i) {
@@ -815,225 +2537,4743 @@ void game_render(Game* self) {
         if (invader->active) {
             int baseIndex = cInvaderTextureTable[invader->invaderType];
             int textureIndex = baseIndex + (invader->frame & 0x1);
+            Rect rect = invader_hit_rect(invader);
             SDL_Rect r;
-            rect_to_sdl(&invader->target, &r);
-            SDL_RenderCopy(renderer, g_textures[textureIndex].texture, NULL, &r);
+            rect_to_sdl(&rect, &r);
+            SDL_RenderCopy(renderer, self->atlas, &cSpriteAtlas.rects[textureIndex], &r);
         }
         else {
-            if (invader->deathTime > 0.f) {
+            if (invader->deathTime > 0) {
                 SDL_Rect r;
                 rect_to_sdl(&invader->target, &r);
-                SDL_RenderCopy(renderer, g_textures[11].texture, NULL, &r);
+                SDL_RenderCopy(renderer, self->atlas, &cSpriteAtlas.rects[cExplosionTexture], &r);
             }
         }
     }
 
+    UfoState* ufo = &state->play.ufo;
+    if (ufo->active || ufo->deathTime > 0) {
+        SDL_Rect r;
+        rect_to_sdl(&ufo->target, &r);
+        SDL_RenderCopy(renderer, self->atlas, &cSpriteAtlas.rects[ufo->active ? cUfoTexture : cExplosionTexture], &r);
+    }
+
     for (int i = 0; i < MAX_BULLETS; ++i) {
         BulletState* bullet = &state->play.bullets[i];
         if (bullet->active) {
             int texIdx = bullet->baseTexture + ((bullet->frame / 30) % bullet->frameCount);
             SDL_Rect r;
             rect_to_sdl(&bullet->target, &r);
-            SDL_RenderCopy(renderer, g_textures[texIdx].texture, NULL, &r);
+            SDL_RenderCopy(renderer, self->atlas, &cSpriteAtlas.rects[texIdx], &r);
         }
     }
-}
 
-void play_reset(PlayState* self) {
+    if (self->session->config.versus && state->play.swarm.aliveCount > 0) {
+        // marks the invader player two will fire from next
+        int shooter = swarm_shooter(&state->play.swarm, state->play.aimColumn);
+        if (shooter >= 0) {
+            Rect target = invader_hit_rect(&state->play.invaders[shooter]);
+            SDL_Rect r;
+            r.x = fx_to_int(target.position.x) - 1;
+            r.y = fx_to_int(target.position.y + target.height / 2) + 2;
+            r.w = 3;
+            r.h = 1;
+            SDL_Color color = cColorPalette[1];
+            SDL_SetRenderDrawColor(renderer, color.r, color.g, color.b, 255);
+            SDL_RenderFillRect(renderer, &r);
+        }
+    }
+
+    if (frame_scheduler_begin(scheduler, FrameTask_ParticleDraw)) {
+        particles_render(self->particles, renderer, cColorPalette);
+        frame_scheduler_end(scheduler, FrameTask_ParticleDraw);
+    }
+    hud_render(&self->hud, renderer, self->atlas, &state->play);
+    if (self->hud.showDebug && frame_scheduler_begin(scheduler, FrameTask_Hud)) {
+        hud_render_debug(&self->hud, renderer, self->atlas, &state->play);
+        frame_scheduler_end(scheduler, FrameTask_Hud);
+    }
+
+    uint64 ns = (SDL_GetPerformanceCounter() - start) * 1000000000 / SDL_GetPerformanceFrequency();
+    frame_scheduler_core(scheduler, ns - SDL_min(scheduler->optionalNs - optionalNs, ns));
+}
+
+// Starts a new game from the first wave
+void play_reset(PlayState* self, Config* config) {
+    self->score = 0;
+    self->lives = config->tankLives;
+    self->wave = 1;
+    play_start_wave(self, config);
+}
+
+// Lays out a fresh wave from its layout and starts its scripts, keeping
+// score and lives
+void play_start_wave(PlayState* self, Config* config) {
+    const WaveLayout* layout = wave_layout(config, self->wave);
     tank_reset(&self->tank);
 
-    for (int i = 0; i < MAX_SHIELDS; ++i) {
-        ShieldState* shield = &self->shields[i];
-        Rect* target = &shield->target;
-        target->position.x = 43 + i * (18 + 33 + ((i - 1) % 2));
-        target->position.y = cScreenHeight - 40;
-        target->width = 18;
-        target->height = 14;
-        if (shield->texture.texture) {
-            SDL_DestroyTexture(shield->texture.texture);
-            shield->texture.texture = NULL;
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        shield_reset(&self->shields[i], i);
+    }
+
+    for (int i = 0; i < MAX_BULLETS; ++i) {
+        bullet_reset(&self->bullets[i]);
+    }
+
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        int x, y;
+        invader_grid_position(layout, i, &x, &y);
+        invader_reset(&self->invaders[i], x, y, layout->rowTypes[i / INVADER_COLS], config, &self->rng);
+    }
+    swarm_rebuild(&self->swarm, self->invaders);
+    if (self->ufo.active) {
+        event_push(&self->events, GameEvent_UfoLeave, self->ufo.target.position, 0);
+    }
+    ufo_reset(&self->ufo);
+    self->moveDelay = config->invaderMoveDelay.max;
+    self->aimColumn = INVADER_COLS / 2;
+    self->aimDelay = 0;
+    self->versusFireDelay = config->versusFireDelay;
+    self->moveIndex = 0;
+    for (int i = 0; i < INVADER_MOVE_QUEUE_SIZE; ++i) {
+        self->moveQueue[i] = InvaderMove_Right;
+    }
+
+    SDL_memset(self->scripts, 0, sizeof(self->scripts));
+    self->scriptEvents = 0;
+    self->diverCount = 0;
+    if (layout->maxDivers > 0) {
+        script_spawn(self->scripts, MAX_SCRIPT_TASKS, Script_Divers, -1, self->tick);
+    }
+    if (layout->shiftMarches > 0) {
+        script_spawn(self->scripts, MAX_SCRIPT_TASKS, Script_Shift, -1, self->tick);
+    }
+    if (layout->ufo) {
+        script_spawn(self->scripts, MAX_SCRIPT_TASKS, Script_Ufo, -1, self->tick);
+    }
+}
+
+void tank_reset(TankState* self) {
+    self->target.position.x = fx_from_int(cScreenWidth / 2);
+    self->target.position.y = fx_from_int(cScreenHeight - 8);
+    self->target.width = fx_from_int(cSprites[cTankTexture].width);
+    self->target.height = fx_from_int(cSprites[cTankTexture].height);
+    self->mode = TankMode_Active;
+    self->respawnDelay = 0;
+    for (int i = 0; i < MAX_TANK_BULLETS; ++i) {
+        self->bullets[i] = -1;
+    }
+}
+
+// Where an invader starts out in a fresh wave
+void invader_grid_position(const WaveLayout* layout, int index, int* x, int* y) {
+    int pitchX, pitchY;
+    invader_grid_pitch(layout, &pitchX, &pitchY);
+    *x = layout->left + (index % INVADER_COLS) * pitchX;
+    *y = layout->top + (index / INVADER_COLS) * pitchY;
+}
+
+// Pixels from one cell of the grid to the next, the largest invader plus the
+// layout's spacing so any row type fits any row
+void invader_grid_pitch(const WaveLayout* layout, int* x, int* y) {
+    int width = 0;
+    int height = 0;
+    for (int i = 0; i < (int)SDL_arraysize(cInvaderTextureTable); ++i) {
+        const Sprite* sprite = &cSprites[cInvaderTextureTable[i]];
+        width = SDL_max(width, sprite->width);
+        height = SDL_max(height, sprite->height);
+    }
+    *x = width + layout->spacing;
+    *y = height + layout->spacing;
+}
+
+// Player two aims at a column of the swarm and fires from its frontier
+// instead of the invaders shooting on their own timers
+void versus_update(PlayState* self, Config* config, uint8 buttons, fixed dt) {
+    SwarmIndex* swarm = &self->swarm;
+    if (swarm->aliveCount == 0) {
+        return;
+    }
+
+    int dir = ((buttons & VERSUS_BUTTON_RIGHT) ? 1 : 0) - ((buttons & VERSUS_BUTTON_LEFT) ? 1 : 0);
+    self->aimDelay -= dt;
+    if (dir == 0) {
+        self->aimDelay = 0;
+    }
+    else if (self->aimDelay <= 0) {
+        self->aimColumn += dir;
+        self->aimDelay = config->versusAimDelay;
+    }
+
+    // stay on an occupied column, sliding further along when one empties
+    self->aimColumn = SDL_max(swarm->leftColumn, SDL_min(self->aimColumn, swarm->rightColumn));
+    while (swarm->columnAlive[self->aimColumn] == 0) {
+        self->aimColumn += (dir < 0) ? -1 : 1;
+        if (self->aimColumn > swarm->rightColumn) {
+            self->aimColumn = swarm->rightColumn;
+            dir = -1;
+        }
+        else if (self->aimColumn < swarm->leftColumn) {
+            self->aimColumn = swarm->leftColumn;
+            dir = 1;
+        }
+    }
+
+    self->versusFireDelay -= dt;
+    if (!(buttons & VERSUS_BUTTON_FIRE) || self->versusFireDelay > 0) {
+        return;
+    }
+
+    if (invader_fire(self, swarm_shooter(swarm, self->aimColumn))) {
+        self->versusFireDelay = config->versusFireDelay;
+    }
+}
+
+void tank_kill(PlayState* self, Config* config) {
+    TankState* tank = &self->tank;
+    if (tank->mode != TankMode_Active) {
+        return;
+    }
+    tank->mode = TankMode_Dead;
+    tank->respawnDelay = config->tankRespawnTime;
+    self->lives--;
+    event_push(&self->events, GameEvent_TankHit, tank->target.position, self->lives);
+}
+
+void bullet_reset(BulletState* self) {
+    self->target.position.x = 0;
+    self->target.position.y = 0;
+    self->target.width = 0;
+    self->target.height = 0;
+    self->active = false;
+    self->frame = 0;
+    self->frameCount = 1;
+    self->baseTexture = 8;
+    self->direction = -1;
+    self->owner = BULLET_OWNER_NONE;
+    self->ownerSlot = 0;
+}
+
+void bullet_remove(PlayState* play, BulletState* self) {
+    self->active = false;
+    int* handles = bullet_owner_handles(play, self->owner);
+    if (handles) {
+        handles[self->ownerSlot] = -1;
+    }
+    self->owner = BULLET_OWNER_NONE;
+    self->ownerSlot = 0;
+}
+
+int* bullet_owner_handles(PlayState* play, int owner) {
+    if (owner == BULLET_OWNER_TANK) {
+        return play->tank.bullets;
+    }
+    if (owner >= 0 && owner < MAX_INVADERS) {
+        return play->invaders[owner].bullets;
+    }
+    return NULL;
+}
+
+// Finds a free owner slot and a free bullet, links them and returns the
+// bullet index, or -1 if either is exhausted.
+int bullet_alloc(PlayState* play, int owner) {
+    int* handles = bullet_owner_handles(play, owner);
+    int slotCount = (owner == BULLET_OWNER_TANK) ? MAX_TANK_BULLETS : MAX_INVADER_BULLETS;
+
+    for (int slot = 0; slot < slotCount; ++slot) {
+        if (handles[slot] >= 0) {
+            continue;
+        }
+        for (int i = 0; i < MAX_BULLETS; ++i) {
+            if (!play->bullets[i].active) {
+                handles[slot] = i;
+                play->bullets[i].owner = owner;
+                play->bullets[i].ownerSlot = slot;
+                return i;
+            }
+        }
+        return -1;
+    }
+    return -1;
+}
+
+void bullet_create(BulletState* self, int x, int y, int bulletType, int owner, int ownerSlot) {
+    self->target.position.x = fx_from_int(x);
+    self->target.position.y = fx_from_int(y);
+    self->active = true;
+    self->frame = 0;
+    self->owner = owner;
+    self->ownerSlot = ownerSlot;
+
+    switch (bulletType) {
+        default:
+        case 0:
+            self->frameCount = 1;
+            self->baseTexture = 8;
+            self->direction = -1;
+            break;
+
+        case 1:
+            self->frameCount = 2;
+            self->baseTexture = 9;
+            self->direction = 1;
+            break;
+    }
+    self->target.width = fx_from_int(cSprites[self->baseTexture].width);
+    self->target.height = fx_from_int(cSprites[self->baseTexture].height);
+}
+
+// Moves bullets [begin, end) and sweeps each one. Writes nothing but those
+// bullets and their phase slots, so any split of the range gives the same.
+void bullet_phase_move(void* data, int begin, int end) {
+    BulletPhase* phase = (BulletPhase*)data;
+    Config* config = phase->config;
+    for (int i = begin; i < end; ++i) {
+        BulletState* bullet = &phase->play->bullets[i];
+        if (!bullet->active) {
+            continue;
+        }
+        bullet->frame++;
+        fixed speed = (bullet->direction > 0) ? config->invaderBulletSpeed : config->tankBulletSpeed;
+        phase->from[i] = bullet->target;
+        bullet->target.position.y += fx_mul(speed, phase->dt) * bullet->direction;
+
+        // everything along the path this tick counts, not just where
+        // the bullet ends up, so large dt can't tunnel through anything
+        bullet_sweep(phase->play, bullet, &phase->from[i], &phase->hits[i]);
+    }
+}
+
+// Finds the earliest hit along the bullet's travel from `from` to its current
+// target. Tank bullets hit invaders, invader bullets hit the tank and both
+// hit shields, which are refined to the pixel. Ties keep the first found.
+bool bullet_sweep(PlayState* play, BulletState* self, Rect* from, BulletHit* hit) {
+    hit->type = BulletHit_None;
+    hit->index = -1;
+    hit->distance = 0;
+    hit->pixel = 0;
+
+    Bounds start = bounds_from_rect(from);
+    Bounds end = bounds_from_rect(&self->target);
+    Bounds path = {
+        SDL_min(start.left, end.left), SDL_max(start.right, end.right),
+        SDL_min(start.top, end.top), SDL_max(start.bottom, end.bottom),
+    };
+    Rect swept = rect_from_bounds(&path);
+
+    fixed distance;
+    if (self->direction < 0) {
+        // divers are outside the formation's bounds so they skip that test
+        if (play->diverCount > 0 || swarm_may_hit(&play->swarm, &swept)) {
+            // only invaders touching the whole path can be hit on the way, and
+            // going through them lowest index first keeps ties as they were
+            uint64 candidates = bounds_overlap_mask(&path, &play->swarm.targets, MAX_INVADERS);
+            for (; candidates; candidates &= candidates - 1) {
+                int i = bit_lowest(candidates);
+                InvaderState* invader = &play->invaders[i];
+                Rect rect = invader_hit_rect(invader);
+                if (invader->active && sweep_vertical(&rect, from, &self->target, &distance) &&
+                    (hit->type == BulletHit_None || distance < hit->distance)) {
+                    hit->type = BulletHit_Invader;
+                    hit->index = i;
+                    hit->distance = distance;
+                }
+            }
+        }
+        if (play->ufo.active && sweep_vertical(&play->ufo.target, from, &self->target, &distance) &&
+            (hit->type == BulletHit_None || distance < hit->distance)) {
+            hit->type = BulletHit_Ufo;
+            hit->index = 0;
+            hit->distance = distance;
+        }
+    }
+    else if (self->direction > 0 && play->tank.mode == TankMode_Active) {
+        if (sweep_vertical(&play->tank.target, from, &self->target, &distance)) {
+            hit->type = BulletHit_Tank;
+            hit->index = 0;
+            hit->distance = distance;
+        }
+    }
+
+    const Sprite* sprite = &cSprites[self->baseTexture + ((self->frame / 30) % self->frameCount)];
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        ShieldState* shield = &play->shields[i];
+        if (!rect_intersects(&shield->target, &swept)) {
+            continue;
+        }
+
+        Sprite shieldSprite = shield_sprite(shield);
+        PxCollisionData collData;
+        int32 rows = px_sweep_vertical(&shield->target, &shieldSprite, from, &self->target, sprite, &collData);
+        if (rows < 0) {
+            continue;
+        }
+
+        distance = fx_from_int(rows);
+        if (hit->type == BulletHit_None || distance < hit->distance) {
+            hit->type = BulletHit_Shield;
+            hit->index = i;
+            hit->distance = distance;
+            hit->pixel = collData.pixelA;
+        }
+    }
+
+    return hit->type != BulletHit_None;
+}
+
+void invader_reset(InvaderState* self, int x, int y, int invaderType, Config* config, Rng* rng) {
+    self->target.position.x = fx_from_int(x);
+    self->target.position.y = fx_from_int(y);
+    const Sprite* sprite = &cSprites[cInvaderTextureTable[invaderType]];
+    self->target.width = fx_from_int(sprite->width);
+    self->target.height = fx_from_int(sprite->height);
+    self->active = true;
+    self->moveDelay = 0;
+    self->fireDelay = range_rand(&config->invaderFireDelay, rng);
+    self->invaderType = invaderType;
+    self->frame = 0;
+    for (int i = 0; i < MAX_INVADER_BULLETS; ++i) {
+        self->bullets[i] = -1;
+    }
+    self->diving = false;
+    self->diveOffset.x = 0;
+    self->diveOffset.y = 0;
+}
+
+void invader_kill(PlayState* self, Config* config, int index) {
+    InvaderState* invader = &self->invaders[index];
+    if (!invader->active) {
+        return;
+    }
+    invader->active = false;
+    invader->deathTime = config->invaderDeathTime;
+    if (invader->diving) {
+        // explodes where it was hit rather than back in its slot
+        invader->target = invader_hit_rect(invader);
+        invader->diveOffset.x = 0;
+        invader->diveOffset.y = 0;
+        invader->diving = false;
+        self->diverCount--;
+    }
+    self->score += cInvaderScoreTable[invader->invaderType];
+    swarm_remove(&self->swarm, self->invaders, index);
+    event_push(&self->events, GameEvent_InvaderKilled, invader->target.position, index);
+}
+
+// Where the invader actually is, out of formation while it dives
+Rect invader_hit_rect(InvaderState* self) {
+    Rect rect = self->target;
+    rect.position.x += self->diveOffset.x;
+    rect.position.y += self->diveOffset.y;
+    return rect;
+}
+
+// Drops a bomb from wherever the invader is, false when it has none left
+bool invader_fire(PlayState* self, int shooter) {
+    int index = bullet_alloc(self, shooter);
+    if (index < 0) {
+        return false;
+    }
+    Rect rect = invader_hit_rect(&self->invaders[shooter]);
+    BulletState* bullet = &self->bullets[index];
+    bullet_create(bullet,
+        fx_to_int(rect.position.x),
+        fx_to_int(rect.position.y),
+        1,
+        bullet->owner,
+        bullet->ownerSlot);
+    event_push(&self->events, GameEvent_InvaderShot, rect.position, shooter);
+    return true;
+}
+
+void invader_dive_move(PlayState* self, int index, fixed dx, fixed dy) {
+    InvaderState* invader = &self->invaders[index];
+    invader->diveOffset.x += dx;
+    invader->diveOffset.y += dy;
+    Rect rect = invader_hit_rect(invader);
+    Bounds bounds = bounds_from_rect(&rect);
+    bounds_batch_set(&self->swarm.targets, index, &bounds);
+}
+
+void ufo_reset(UfoState* self) {
+    self->target.position.x = 0;
+    self->target.position.y = fx_from_int(12);
+    self->target.width = fx_from_int(cSprites[cUfoTexture].width);
+    self->target.height = fx_from_int(cSprites[cUfoTexture].height);
+    self->active = false;
+    self->direction = 1;
+    self->deathTime = 0;
+}
+
+void ufo_kill(PlayState* self, Config* config) {
+    UfoState* ufo = &self->ufo;
+    if (!ufo->active) {
+        return;
+    }
+    ufo->active = false;
+    ufo->deathTime = config->invaderDeathTime;
+    self->score += cUfoScoreTable[rng_next(&self->rng) & 0x3];
+    event_push(&self->events, GameEvent_UfoKilled, ufo->target.position, 0);
+}
+
+const WaveLayout* wave_layout(Config* config, int wave) {
+    if (config->stress) {
+        return &cStressWaveLayout;
+    }
+    return &cWaveLayouts[SDL_min(wave, (int)SDL_arraysize(cWaveLayouts)) - 1];
+}
+
+// Moves the whole formation at once, on top of its march
+void play_shift_formation(PlayState* self, fixed dy) {
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        InvaderState* invader = &self->invaders[i];
+        if (invader->active) {
+            invader->target.position.y += dy;
+        }
+    }
+    swarm_translate(&self->swarm, 0, dy);
+}
+
+// Runs the wave's scripts after everything else in the tick, so they see
+// every event it pushed. What they push themselves they see next tick.
+void play_run_scripts(PlayState* self, Config* config, fixed dt) {
+    uint32 before = self->events.mask;
+    ScriptContext ctx;
+    ctx.play = self;
+    ctx.config = config;
+    ctx.dt = dt;
+    ctx.tick = self->tick;
+    ctx.events = before | self->scriptEvents;
+    script_run(self->scripts, MAX_SCRIPT_TASKS, &ctx);
+    self->scriptEvents = self->events.mask & ~before;
+}
+
+static const ScriptFunc cScripts[Script_Count] = {
+    NULL,
+    script_divers,
+    script_dive,
+    script_shift,
+    script_ufo,
+    script_ufo_pass,
+    script_bench,
+};
+
+// Starts a script on the first free task, running from the tick after `tick`.
+// Returns the task index or -1 when every task is busy.
+int script_spawn(ScriptTask* tasks, int count, ScriptId script, int target, uint32 tick) {
+    for (int i = 0; i < count; ++i) {
+        ScriptTask* task = &tasks[i];
+        if (task->script != Script_None) {
+            continue;
+        }
+        task->script = (uint8)script;
+        task->wait = ScriptWait_Ticks;
+        task->resume = 0;
+        task->until = (int32)(tick + 1);
+        task->target = (int16)target;
+        task->counter = 0;
+        return i;
+    }
+    return -1;
+}
+
+// Resumes every task whose wait is over, in task order. Nothing is allocated
+// and a waiting task costs one compare.
+void script_run(ScriptTask* tasks, int count, ScriptContext* ctx) {
+    for (int i = 0; i < count; ++i) {
+        ScriptTask* task = &tasks[i];
+        if (task->script == Script_None) {
+            continue;
+        }
+        switch (task->wait) {
+            case ScriptWait_Ticks:
+                if ((int32)(ctx->tick - (uint32)task->until) < 0) {
+                    continue;
+                }
+                break;
+            case ScriptWait_Timer:
+                task->until -= ctx->dt;
+                if (task->until > 0) {
+                    continue;
+                }
+                break;
+            case ScriptWait_Events:
+                if (!(ctx->events & (uint32)task->until)) {
+                    continue;
+                }
+                break;
+            default:
+                break;
+        }
+        task->wait = ScriptWait_None;
+        if (cScripts[task->script](task, ctx)) {
+            task->script = Script_None;
+        }
+    }
+}
+
+// Every so often sends frontier invaders from random columns at the tank
+// together, as many as the wave allows in the air at once
+bool script_divers(ScriptTask* task, ScriptContext* ctx) {
+    PlayState* play = ctx->play;
+    SwarmIndex* swarm = &play->swarm;
+    SCRIPT_BEGIN(task);
+    for (;;) {
+        SCRIPT_WAIT_TIMER(task, range_rand(&ctx->config->diveDelay, &play->rng));
+        int maxDivers = wave_layout(ctx->config, play->wave)->maxDivers;
+        for (int attempt = 0; attempt < INVADER_COLS && swarm->aliveCount > 1 && play->diverCount < maxDivers; ++attempt) {
+            int column = swarm->leftColumn + (int)(rng_next(&play->rng) % (uint32)(swarm->rightColumn - swarm->leftColumn + 1));
+            int index = swarm_shooter(swarm, column);
+            if (index >= 0 && !play->invaders[index].diving &&
+                script_spawn(play->scripts, MAX_SCRIPT_TASKS, Script_Dive, index, ctx->tick) >= 0) {
+                play->invaders[index].diving = true;
+                play->diverCount++;
+            }
+        }
+    }
+    SCRIPT_END(task);
+}
+
+// One invader swoops toward the tank until just above the shields, bombs it
+// and climbs back into its slot, which kept marching without it
+bool script_dive(ScriptTask* task, ScriptContext* ctx) {
+    PlayState* play = ctx->play;
+    InvaderState* invader = &play->invaders[task->target];
+    if (!invader->active) {
+        return true; // shot down, invader_kill already let go of it
+    }
+    ShieldState* shield = &play->shields[0];
+    fixed floor = shield->target.position.y - (shield->target.height + invader->target.height) / 2 - fx_from_int(2);
+    fixed step = fx_mul(ctx->config->diveSpeed, ctx->dt);
+    fixed reach = ctx->config->diveMaxDepth;
+    Rect rect = invader_hit_rect(invader);
+
+    SCRIPT_BEGIN(task);
+    while (rect.position.y < floor && invader->diveOffset.y < reach) {
+        fixed dx = clamp(play->tank.target.position.x - rect.position.x, -step / 2, step / 2);
+        dx = clamp(invader->diveOffset.x + dx, -reach, reach) - invader->diveOffset.x;
+        invader_dive_move(play, task->target, dx, SDL_min(step, reach - invader->diveOffset.y));
+        SCRIPT_YIELD(task, ctx);
+    }
+
+    if (!ctx->config->versus) {
+        invader_fire(play, task->target);
+    }
+
+    while (invader->diveOffset.x != 0 || invader->diveOffset.y != 0) {
+        invader_dive_move(play, task->target,
+            clamp(-invader->diveOffset.x, -step, step),
+            clamp(-invader->diveOffset.y, -step, step));
+        SCRIPT_YIELD(task, ctx);
+    }
+    invader->diving = false;
+    play->diverCount--;
+    SCRIPT_END(task);
+}
+
+// Steps the formation down a row's worth every few marches
+bool script_shift(ScriptTask* task, ScriptContext* ctx) {
+    PlayState* play = ctx->play;
+    SCRIPT_BEGIN(task);
+    for (;;) {
+        for (task->counter = 0; task->counter < wave_layout(ctx->config, play->wave)->shiftMarches; ++task->counter) {
+            SCRIPT_WAIT_EVENTS(task, SCRIPT_EVENT(GameEvent_InvaderMarch));
+        }
+        if (play->swarm.aliveCount > 0) {
+            play_shift_formation(play, ctx->config->invaderMoveAmount);
+        }
+    }
+    SCRIPT_END(task);
+}
+
+// Sends the UFO over every so often while there is still a swarm worth
+// flying over, one pass at a time
+bool script_ufo(ScriptTask* task, ScriptContext* ctx) {
+    PlayState* play = ctx->play;
+    SCRIPT_BEGIN(task);
+    for (;;) {
+        SCRIPT_WAIT_TIMER(task, range_rand(&ctx->config->ufoDelay, &play->rng));
+        if (play->swarm.aliveCount >= 8 && script_spawn(play->scripts, MAX_SCRIPT_TASKS, Script_UfoPass, -1, ctx->tick) >= 0) {
+            SCRIPT_WAIT_EVENTS(task, SCRIPT_EVENT(GameEvent_UfoLeave) | SCRIPT_EVENT(GameEvent_UfoKilled));
+        }
+    }
+    SCRIPT_END(task);
+}
+
+// Flies the UFO across the top of the screen from a random side
+bool script_ufo_pass(ScriptTask* task, ScriptContext* ctx) {
+    PlayState* play = ctx->play;
+    UfoState* ufo = &play->ufo;
+    fixed halfWidth = ufo->target.width / 2;
+    SCRIPT_BEGIN(task);
+    ufo->direction = (rng_next(&play->rng) & 0x1) ? 1 : -1;
+    ufo->target.position.x = (ufo->direction > 0) ? -halfWidth : fx_from_int(cScreenWidth) + halfWidth;
+    ufo->active = true;
+    ufo->deathTime = 0;
+    event_push(&play->events, GameEvent_UfoEnter, ufo->target.position, 0);
+
+    while (ufo->active) {
+        SCRIPT_YIELD(task, ctx);
+        if (ufo->active) {
+            ufo->target.position.x += fx_mul(ctx->config->ufoSpeed, ctx->dt) * ufo->direction;
+            if (ufo->target.position.x < -halfWidth || ufo->target.position.x > fx_from_int(cScreenWidth) + halfWidth) {
+                ufo->active = false;
+                event_push(&play->events, GameEvent_UfoLeave, ufo->target.position, 0);
+            }
+        }
+    }
+    SCRIPT_END(task);
+}
+
+// Stands in for a scripted entity in --script-bench, cycling through every
+// kind of wait
+bool script_bench(ScriptTask* task, ScriptContext* ctx) {
+    SCRIPT_BEGIN(task);
+    for (;;) {
+        SCRIPT_WAIT_TICKS(task, ctx, 1 + (task->target & 0x7));
+        SCRIPT_WAIT_TIMER(task, FX(0.05) * (1 + (task->counter & 0x3)));
+        task->counter++;
+        SCRIPT_WAIT_EVENTS(task, SCRIPT_EVENT(GameEvent_InvaderMarch) | SCRIPT_EVENT(GameEvent_TankShot));
+    }
+    SCRIPT_END(task);
+}
+
+void play_check_wave_end(PlayState* self, Config* config) {
+    TankState* tank = &self->tank;
+    if (self->swarm.aliveCount == 0 && self->lives > 0) {
+        self->wave++;
+        play_start_wave(self, config);
+    }
+    else if (self->swarm.aliveCount == 0 ||
+        self->swarm.hitBounds.bottom >= tank->target.position.y - tank->target.height / 2) {
+        // the swarm landed or the last tank went down with the last invader
+        play_reset(self, config);
+    }
+}
+
+const char* play_check_invariants(PlayState* self) {
+    const fixed limit = fx_from_int(4096);
+    TankState* tank = &self->tank;
+
+    if (tank->target.position.x < tank->target.width / 2 ||
+        tank->target.position.x > fx_from_int(cScreenWidth) - tank->target.width / 2 ||
+        tank->target.position.y < 0 || tank->target.position.y > fx_from_int(cScreenHeight)) {
+        return "tank out of bounds";
+    }
+
+    int tankBullets = 0;
+    for (int i = 0; i < MAX_TANK_BULLETS; ++i) {
+        int handle = tank->bullets[i];
+        if (handle < -1 || handle >= MAX_BULLETS) {
+            return "tank bullet handle out of range";
+        }
+        if (handle >= 0) {
+            BulletState* bullet = &self->bullets[handle];
+            if (!bullet->active || bullet->owner != BULLET_OWNER_TANK || bullet->ownerSlot != i) {
+                return "tank bullet handle does not point back";
+            }
+            ++tankBullets;
+        }
+    }
+    if (tankBullets > MAX_TANK_BULLETS) {
+        return "too many tank bullets";
+    }
+    if (self->lives < 0 || self->wave < 1 || (tank->mode == TankMode_Active && self->lives == 0)) {
+        return "lives or wave out of range";
+    }
+    if (self->aimColumn < 0 || self->aimColumn >= INVADER_COLS) {
+        return "aim column out of range";
+    }
+
+    int alive = 0;
+    int divers = 0;
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        InvaderState* invader = &self->invaders[i];
+        for (int j = 0; j < MAX_INVADER_BULLETS; ++j) {
+            int handle = invader->bullets[j];
+            if (handle < -1 || handle >= MAX_BULLETS) {
+                return "invader bullet handle out of range";
+            }
+            if (handle >= 0) {
+                BulletState* bullet = &self->bullets[handle];
+                if (!bullet->active || bullet->owner != i || bullet->ownerSlot != j) {
+                    return "invader bullet handle does not point back";
+                }
+            }
+        }
+        if (invader->target.position.x < -limit || invader->target.position.x > limit ||
+            invader->target.position.y < -limit || invader->target.position.y > limit) {
+            return "invader position diverged";
+        }
+        if (invader->active) {
+            ++alive;
+            Rect rect = invader_hit_rect(invader);
+            if (invader->target.position.x < 0 || invader->target.position.x > fx_from_int(cScreenWidth) ||
+                invader->target.position.y < 0 || invader->target.position.y > fx_from_int(cScreenHeight) ||
+                rect.position.x < 0 || rect.position.x > fx_from_int(cScreenWidth) ||
+                rect.position.y < 0 || rect.position.y > fx_from_int(cScreenHeight)) {
+                return "invader out of bounds";
+            }
+            divers += invader->diving;
+        }
+        else if (invader->diving || invader->diveOffset.x != 0 || invader->diveOffset.y != 0) {
+            return "dead invader still diving";
+        }
+    }
+
+    if (alive != self->swarm.aliveCount) {
+        return "swarm alive count out of sync";
+    }
+    int diveTasks = 0;
+    for (int i = 0; i < MAX_SCRIPT_TASKS; ++i) {
+        ScriptTask* task = &self->scripts[i];
+        if (task->script >= Script_Count || task->wait > ScriptWait_Events) {
+            return "script task corrupt";
+        }
+        if (task->script == Script_Dive) {
+            if (task->target < 0 || task->target >= MAX_INVADERS || !self->invaders[task->target].diving) {
+                return "dive task lost its invader";
+            }
+            ++diveTasks;
+        }
+    }
+    if (divers != self->diverCount || diveTasks != divers || divers > MAX_DIVERS) {
+        return "diver count out of sync";
+    }
+    if (self->ufo.active && (self->ufo.target.position.x < -self->ufo.target.width ||
+        self->ufo.target.position.x > fx_from_int(cScreenWidth) + self->ufo.target.width)) {
+        return "ufo out of bounds";
+    }
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        const BoundsBatch* targets = &self->swarm.targets;
+        Rect rect = invader_hit_rect(&self->invaders[i]);
+        Bounds b = bounds_from_rect(&rect);
+        bool empty = targets->left[i] > targets->right[i];
+        if (self->invaders[i].active ? (targets->left[i] != b.left || targets->right[i] != b.right ||
+            targets->top[i] != b.top || targets->bottom[i] != b.bottom) : !empty) {
+            return "swarm target bounds out of sync";
+        }
+    }
+    for (int col = 0; col < INVADER_COLS; ++col) {
+        int count = 0;
+        int bottom = -1;
+        for (int row = 0; row < INVADER_ROWS; ++row) {
+            if (self->invaders[row * INVADER_COLS + col].active) {
+                ++count;
+                bottom = row;
+            }
+        }
+        if (count != self->swarm.columnAlive[col] || bottom != self->swarm.columnBottom[col]) {
+            return "swarm column index out of sync";
+        }
+    }
+
+    int active = 0;
+    for (int i = 0; i < MAX_BULLETS; ++i) {
+        BulletState* bullet = &self->bullets[i];
+        if (!bullet->active) {
+            continue;
+        }
+        ++active;
+        if (bullet->target.position.x < 0 || bullet->target.position.x > fx_from_int(cScreenWidth) ||
+            bullet->target.position.y < 0 || bullet->target.position.y > fx_from_int(cScreenHeight + 4)) {
+            return "bullet out of bounds";
+        }
+        int* handles = bullet_owner_handles(self, bullet->owner);
+        int slotCount = (bullet->owner == BULLET_OWNER_TANK) ? MAX_TANK_BULLETS : MAX_INVADER_BULLETS;
+        if (handles && (bullet->ownerSlot < 0 || bullet->ownerSlot >= slotCount || handles[bullet->ownerSlot] != i)) {
+            return "bullet owner does not point back";
+        }
+    }
+    if (active > MAX_BULLETS || self->events.count > MAX_GAME_EVENTS) {
+        return "count over capacity";
+    }
+
+    return NULL;
+}
+
+void swarm_refresh_bounds(SwarmIndex* self, InvaderState* invaders) {
+    if (self->aliveCount == 0) {
+        Bounds empty = { 0, 0, 0, 0 };
+        self->bounds = empty;
+        self->hitBounds = empty;
+        return;
+    }
+
+    // every invader in a column shares x and every invader in a row shares y,
+    // so any alive member of the extreme rows/columns gives the bound
+    int topIndex = self->topRow * INVADER_COLS;
+    while (!invaders[topIndex].active) {
+        ++topIndex;
+    }
+    int leftIndex = self->columnBottom[self->leftColumn] * INVADER_COLS + self->leftColumn;
+    int rightIndex = self->columnBottom[self->rightColumn] * INVADER_COLS + self->rightColumn;
+    int bottomIndex = self->bottomRow * INVADER_COLS;
+    while (!invaders[bottomIndex].active) {
+        ++bottomIndex;
+    }
+
+    self->bounds.left = invaders[leftIndex].target.position.x;
+    self->bounds.right = invaders[rightIndex].target.position.x;
+    self->bounds.top = invaders[topIndex].target.position.y;
+    self->bounds.bottom = invaders[bottomIndex].target.position.y;
+
+    fixed halfWidth = 0, halfHeight = 0;
+    for (int i = 0; i < 3; ++i) {
+        const Sprite* sprite = &cSprites[cInvaderTextureTable[i]];
+        if (fx_from_int(sprite->width) / 2 > halfWidth) halfWidth = fx_from_int(sprite->width) / 2;
+        if (fx_from_int(sprite->height) / 2 > halfHeight) halfHeight = fx_from_int(sprite->height) / 2;
+    }
+    self->hitBounds.left = self->bounds.left - halfWidth;
+    self->hitBounds.right = self->bounds.right + halfWidth;
+    self->hitBounds.top = self->bounds.top - halfHeight;
+    self->hitBounds.bottom = self->bounds.bottom + halfHeight;
+}
+
+void swarm_rebuild(SwarmIndex* self, InvaderState* invaders) {
+    self->aliveCount = 0;
+    for (int col = 0; col < INVADER_COLS; ++col) {
+        self->columnAlive[col] = 0;
+        self->columnBottom[col] = -1;
+    }
+    for (int row = 0; row < INVADER_ROWS; ++row) {
+        self->rowAlive[row] = 0;
+    }
+
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        if (!invaders[i].active) {
+            bounds_batch_clear(&self->targets, i);
+            continue;
+        }
+        Rect rect = invader_hit_rect(&invaders[i]);
+        Bounds bounds = bounds_from_rect(&rect);
+        bounds_batch_set(&self->targets, i, &bounds);
+        int row = i / INVADER_COLS;
+        int col = i % INVADER_COLS;
+        ++self->aliveCount;
+        ++self->columnAlive[col];
+        ++self->rowAlive[row];
+        if (row > self->columnBottom[col]) {
+            self->columnBottom[col] = row;
+        }
+    }
+
+    self->leftColumn = 0;
+    while (self->leftColumn < INVADER_COLS && self->columnAlive[self->leftColumn] == 0) {
+        ++self->leftColumn;
+    }
+    self->rightColumn = INVADER_COLS - 1;
+    while (self->rightColumn >= 0 && self->columnAlive[self->rightColumn] == 0) {
+        --self->rightColumn;
+    }
+    self->topRow = 0;
+    while (self->topRow < INVADER_ROWS && self->rowAlive[self->topRow] == 0) {
+        ++self->topRow;
+    }
+    self->bottomRow = INVADER_ROWS - 1;
+    while (self->bottomRow >= 0 && self->rowAlive[self->bottomRow] == 0) {
+        --self->bottomRow;
+    }
+
+    swarm_refresh_bounds(self, invaders);
+}
+
+void swarm_remove(SwarmIndex* self, InvaderState* invaders, int index) {
+    int row = index / INVADER_COLS;
+    int col = index % INVADER_COLS;
+
+    --self->aliveCount;
+    --self->columnAlive[col];
+    --self->rowAlive[row];
+    bounds_batch_clear(&self->targets, index);
+
+    // walk the column frontier up past any dead invaders
+    if (self->columnBottom[col] == row) {
+        int r = row - 1;
+        while (r >= 0 && !invaders[r * INVADER_COLS + col].active) {
+            --r;
+        }
+        self->columnBottom[col] = r;
+    }
+
+    while (self->leftColumn <= self->rightColumn && self->columnAlive[self->leftColumn] == 0) {
+        ++self->leftColumn;
+    }
+    while (self->rightColumn >= self->leftColumn && self->columnAlive[self->rightColumn] == 0) {
+        --self->rightColumn;
+    }
+    while (self->topRow <= self->bottomRow && self->rowAlive[self->topRow] == 0) {
+        ++self->topRow;
+    }
+    while (self->bottomRow >= self->topRow && self->rowAlive[self->bottomRow] == 0) {
+        --self->bottomRow;
+    }
+
+    swarm_refresh_bounds(self, invaders);
+}
+
+void swarm_translate(SwarmIndex* self, fixed dx, fixed dy) {
+    if (self->aliveCount == 0) {
+        return;
+    }
+    self->bounds.left += dx;
+    self->bounds.right += dx;
+    self->bounds.top += dy;
+    self->bounds.bottom += dy;
+    self->hitBounds.left += dx;
+    self->hitBounds.right += dx;
+    self->hitBounds.top += dy;
+    self->hitBounds.bottom += dy;
+    bounds_batch_translate(&self->targets, MAX_INVADERS, dx, dy);
+}
+
+int swarm_shooter(SwarmIndex* self, int column) {
+    int row = self->columnBottom[column];
+    if (row < 0) {
+        return -1;
+    }
+    return row * INVADER_COLS + column;
+}
+
+bool swarm_may_hit(SwarmIndex* self, Rect* rect) {
+    if (self->aliveCount == 0) {
+        return false;
+    }
+    Bounds b = bounds_from_rect(rect);
+    return b.top <= self->hitBounds.bottom && b.bottom >= self->hitBounds.top &&
+        b.left <= self->hitBounds.right && b.right >= self->hitBounds.left;
+}
+
+void shield_reset(ShieldState* self, int index) {
+    Rect* target = &self->target;
+    target->position.x = fx_from_int(43 + index * (SHIELD_WIDTH + 33 + ((index - 1) % 2)));
+    target->position.y = fx_from_int(cScreenHeight - 40);
+    target->width = fx_from_int(SHIELD_WIDTH);
+    target->height = fx_from_int(SHIELD_HEIGHT);
+    SDL_memcpy(self->pixels, cShieldImageData, sizeof(self->pixels));
+    SDL_memcpy(self->mask, cSprites[cShieldTexture].mask, sizeof(self->mask));
+    self->version++;
+}
+
+// Erodes the shield around each hit pixel. Only touches session state, the
+// renderer picks the change up from the version.
+void shield_damage(ShieldState* self, int32* indices, int32 count) {
+    const int half = SHIELD_BLAST_SIZE / 2;
+    for (int i = 0; i < count; ++i) {
+        int hitX = indices[i] % SHIELD_WIDTH;
+        int hitY = indices[i] / SHIELD_WIDTH;
+        for (int by = 0; by < SHIELD_BLAST_SIZE; ++by) {
+            int y = hitY + by - half;
+            if (y < 0 || y >= SHIELD_HEIGHT) {
+                continue;
+            }
+            for (int bx = 0; bx < SHIELD_BLAST_SIZE; ++bx) {
+                int x = hitX + bx - half;
+                if (x >= 0 && x < SHIELD_WIDTH && cShieldBlastData[by * SHIELD_BLAST_SIZE + bx]) {
+                    self->pixels[y * SHIELD_WIDTH + x] = 0;
+                    self->mask[y] &= ~(1u << x);
+                }
+            }
+        }
+        // the hit pixel itself always goes so a shot can never stick
+        self->pixels[indices[i]] = 0;
+        self->mask[hitY] &= ~(1u << hitX);
+    }
+    self->version++;
+}
+
+Sprite shield_sprite(ShieldState* self) {
+    Sprite result = {
+        self->pixels, SHIELD_WIDTH, SHIELD_HEIGHT, self->mask,
+    };
+    return result;
+}
+
+void input_reset(InputState* self) {
+    for (int i = 0; i < 512; ++i) {
+        self->prevKeys[i] = false;
+        self->currKeys[i] = false;
+    }
+}
+
+void input_update(InputState* self) {
+    for (int i = 0; i < 512; ++i) {
+        self->prevKeys[i] = self->currKeys[i];
+    }
+}
+
+void input_set_key(InputState* self, int scancode, bool isDown) {
+    self->currKeys[scancode] = isDown;
+}
+
+bool input_get_key(InputState* self, int scancode) {
+    return self->currKeys[scancode];
+}
+
+bool input_get_down(InputState* self, int scancode) {
+    return self->currKeys[scancode] && !self->prevKeys[scancode];
+}
+
+bool input_get_up(InputState* self, int scancode) {
+    return !self->currKeys[scancode] && self->prevKeys[scancode];
+}
+
+void event_push(EventList* self, GameEventType type, Point position, int param) {
+    self->mask |= 1u << type;
+    if (self->count >= MAX_GAME_EVENTS) {
+        return;
+    }
+    GameEvent* event = &self->events[self->count++];
+    event->type = type;
+    event->position = position;
+    event->param = param;
+}
+
+int text_width(const char* text) {
+    int length = (int)SDL_strlen(text);
+    return length > 0 ? length * GLYPH_ADVANCE - 1 : 0;
+}
+
+// Draws text as palette indices into a width x height buffer, clipped
+void text_rasterize(uint8* pixels, int width, int height, int x, int y, const char* text, uint8 color) {
+    for (; *text; ++text, x += GLYPH_ADVANCE) {
+        char c = *text;
+        if (c < GLYPH_FIRST || c > GLYPH_LAST) {
+            continue;
+        }
+        uint16 bits = cGlyphData[c - GLYPH_FIRST];
+        for (int gy = 0; gy < GLYPH_HEIGHT; ++gy) {
+            int py = y + gy;
+            if (py < 0 || py >= height) {
+                continue;
+            }
+            for (int gx = 0; gx < GLYPH_WIDTH; ++gx) {
+                int px = x + gx;
+                int bit = GLYPH_WIDTH * GLYPH_HEIGHT - 1 - (gy * GLYPH_WIDTH + gx);
+                if (px >= 0 && px < width && (bits >> bit) & 1) {
+                    pixels[py * width + px] = color;
+                }
+            }
+        }
+    }
+}
+
+bool text_run_stale(TextRun* self, int64 value) {
+    return !self->built || self->value != value;
+}
+
+void text_run_build(TextRun* self, int64 value, const char* text) {
+    int length = 0;
+    for (; *text && length < MAX_TEXT_RUN; ++text) {
+        char c = *text;
+        self->glyphs[length++] = (c < GLYPH_FIRST || c > GLYPH_LAST) ? 0 : (uint8)(c - GLYPH_FIRST);
+    }
+    self->length = length;
+    self->width = length > 0 ? length * GLYPH_ADVANCE - 1 : 0;
+    self->value = value;
+    self->built = true;
+}
+
+void text_run_draw(TextRun* self, SDL_Renderer* renderer, SDL_Texture* atlas, int x, int y) {
+    for (int i = 0; i < self->length; ++i, x += GLYPH_ADVANCE) {
+        if (self->glyphs[i] != 0) {
+            SDL_Rect r = { x, y, GLYPH_WIDTH, GLYPH_HEIGHT };
+            SDL_RenderCopy(renderer, atlas, &cSpriteAtlas.glyphs[self->glyphs[i]], &r);
+        }
+    }
+}
+
+void hud_frame_time(Hud* self, uint64 ns, int particles) {
+    self->frameTimeAccum += ns;
+    self->frameCount++;
+    // refresh twice a second so the debug line stays readable and cheap
+    if (self->frameTimeAccum >= 500000000) {
+        self->frameTimeUs = (uint32)(self->frameTimeAccum / self->frameCount / 1000);
+        self->particleCount = particles;
+        self->frameTimeAccum = 0;
+        self->frameCount = 0;
+    }
+}
+
+void hud_render(Hud* self, SDL_Renderer* renderer, SDL_Texture* atlas, PlayState* play) {
+    char text[MAX_TEXT_RUN];
+
+    if (text_run_stale(&self->score, play->score)) {
+        SDL_snprintf(text, sizeof(text), "SCORE %05u", play->score);
+        text_run_build(&self->score, play->score, text);
+    }
+    if (text_run_stale(&self->wave, play->wave)) {
+        SDL_snprintf(text, sizeof(text), "WAVE %d", play->wave);
+        text_run_build(&self->wave, play->wave, text);
+    }
+    if (text_run_stale(&self->lives, play->lives)) {
+        SDL_snprintf(text, sizeof(text), "LIVES %d", play->lives);
+        text_run_build(&self->lives, play->lives, text);
+    }
+
+    text_run_draw(&self->score, renderer, atlas, 2, 2);
+    text_run_draw(&self->wave, renderer, atlas, (cScreenWidth - self->wave.width) / 2, 2);
+    text_run_draw(&self->lives, renderer, atlas, cScreenWidth - self->lives.width - 2, 2);
+
+    if (self->turboSpeed > 0) {
+        if (text_run_stale(&self->turbo, self->turboSpeed)) {
+            SDL_snprintf(text, sizeof(text), "TURBO X%u", self->turboSpeed);
+            text_run_build(&self->turbo, self->turboSpeed, text);
+        }
+        text_run_draw(&self->turbo, renderer, atlas, cScreenWidth - self->turbo.width - 2, 9);
+    }
+
+    if (self->rewindTicks > 0) {
+        uint32 tenths = self->rewindTicks * 10 / SIM_TICK_RATE;
+        if (text_run_stale(&self->rewind, tenths)) {
+            SDL_snprintf(text, sizeof(text), "REWIND -%u.%uS", tenths / 10, tenths % 10);
+            text_run_build(&self->rewind, tenths, text);
+        }
+        text_run_draw(&self->rewind, renderer, atlas, cScreenWidth - self->rewind.width - 2, 9);
+    }
+}
+
+// The F4 line, drawn only when the frame has time for it
+void hud_render_debug(Hud* self, SDL_Renderer* renderer, SDL_Texture* atlas, PlayState* play) {
+    char text[MAX_TEXT_RUN];
+    int bullets = 0;
+    for (int i = 0; i < MAX_BULLETS; ++i) {
+        bullets += play->bullets[i].active;
+    }
+    int64 key = (int64)self->frameTimeUs << 40 | (int64)self->particleCount << 16 |
+        (int64)bullets << 8 | play->swarm.aliveCount;
+    if (text_run_stale(&self->debug, key)) {
+        SDL_snprintf(text, sizeof(text), "FT %u.%02uMS INV %d BUL %d PAR %d",
+            self->frameTimeUs / 1000, self->frameTimeUs % 1000 / 10, play->swarm.aliveCount, bullets,
+            self->particleCount);
+        text_run_build(&self->debug, key, text);
+    }
+    text_run_draw(&self->debug, renderer, atlas, 2, 9);
+}
+
+// Same layout as hud_render, for captures and other offline frames
+void hud_rasterize(PlayState* play, uint8* pixels) {
+    char text[MAX_TEXT_RUN];
+
+    SDL_snprintf(text, sizeof(text), "SCORE %05u", play->score);
+    text_rasterize(pixels, SCREEN_WIDTH, SCREEN_HEIGHT, 2, 2, text, 1);
+
+    SDL_snprintf(text, sizeof(text), "WAVE %d", play->wave);
+    text_rasterize(pixels, SCREEN_WIDTH, SCREEN_HEIGHT, (SCREEN_WIDTH - text_width(text)) / 2, 2, text, 1);
+
+    SDL_snprintf(text, sizeof(text), "LIVES %d", play->lives);
+    text_rasterize(pixels, SCREEN_WIDTH, SCREEN_HEIGHT, SCREEN_WIDTH - text_width(text) - 2, 2, text, 1);
+}
+
+void particles_init(ParticlePool* self, uint32 seed) {
+    self->count = 0;
+    self->detail = 1.f;
+    rng_seed(&self->rng, seed ^ 0x9a271c1eu);
+}
+
+// Appends up to count particles flying out of (x, y), dropping whatever does
+// not fit rather than evicting live ones. With SSE2 they spawn four at a time
+// from four xorshift lanes seeded off the pool's stream.
+void particles_burst(ParticlePool* self, float32 x, float32 y, int count, float32 speed, float32 life, uint8 color) {
+    int start = self->count;
+    int end = SDL_min(start + count, MAX_PARTICLES);
+    int i = start;
+
+#ifdef VASION_SSE2
+    if (end - i >= 4) {
+        __m128i lanes = _mm_set_epi32((int)rng_next(&self->rng), (int)rng_next(&self->rng),
+            (int)rng_next(&self->rng), (int)rng_next(&self->rng));
+        const __m128i low16 = _mm_set1_epi32(0xffff);
+        const __m128i low8 = _mm_set1_epi32(0xff);
+        const __m128i biasX = _mm_set1_epi32(0x8000);
+        const __m128i biasY = _mm_set1_epi32(0xa000);
+        const __m128 unit = _mm_set1_ps(1.f / 32768.f);
+        const __m128 vx0 = _mm_set1_ps(x);
+        const __m128 vy0 = _mm_set1_ps(y);
+        const __m128 vspeed = _mm_set1_ps(speed);
+        const __m128 vlife = _mm_set1_ps(life);
+        for (; i + 4 <= end; i += 4) {
+            lanes = _mm_xor_si128(lanes, _mm_slli_epi32(lanes, 13));
+            lanes = _mm_xor_si128(lanes, _mm_srli_epi32(lanes, 17));
+            lanes = _mm_xor_si128(lanes, _mm_slli_epi32(lanes, 5));
+            __m128 dx = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(_mm_and_si128(lanes, low16), biasX)), unit);
+            __m128 dy = _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(lanes, 16), biasY)), unit);
+            __m128 jitter = _mm_add_ps(_mm_set1_ps(0.5f),
+                _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(lanes, low8)), _mm_set1_ps(1.f / 512.f)));
+            _mm_storeu_ps(self->x + i, vx0);
+            _mm_storeu_ps(self->y + i, vy0);
+            _mm_storeu_ps(self->vx + i, _mm_mul_ps(_mm_mul_ps(dx, vspeed), jitter));
+            _mm_storeu_ps(self->vy + i, _mm_mul_ps(_mm_mul_ps(dy, vspeed), jitter));
+            _mm_storeu_ps(self->life + i, _mm_mul_ps(vlife, jitter));
+        }
+        SDL_memset(self->color + start, color, i - start);
+    }
+#endif
+
+    for (; i < end; ++i) {
+        uint32 r = rng_next(&self->rng);
+        // signed unit-ish direction from two 16 bit halves, biased upwards
+        float32 dx = (float32)(int32)((r & 0xffff) - 0x8000) / 32768.f;
+        float32 dy = (float32)(int32)((r >> 16) - 0xa000) / 32768.f;
+        float32 jitter = 0.5f + (float32)(r & 0xff) / 512.f;
+        self->x[i] = x;
+        self->y[i] = y;
+        self->vx[i] = dx * speed * jitter;
+        self->vy[i] = dy * speed * jitter;
+        self->life[i] = life * jitter;
+        self->color[i] = color;
+    }
+    self->count = end;
+}
+
+void particles_post_events(ParticlePool* self, EventList* events) {
+    for (int i = 0; i < events->count; ++i) {
+        GameEvent* event = &events->events[i];
+        float32 x = fx_to_float(event->position.x);
+        float32 y = fx_to_float(event->position.y);
+        float32 d = self->detail;
+        switch (event->type) {
+            case GameEvent_InvaderKilled: particles_burst(self, x, y, (int)(48 * d), 60.f, 0.8f, 1); break;
+            case GameEvent_TankHit: particles_burst(self, x, y, (int)(160 * d), 80.f, 1.4f, 2); break;
+            case GameEvent_ShieldHit: particles_burst(self, x, y, (int)(16 * d), 40.f, 0.6f, 2); break;
+            case GameEvent_UfoKilled: particles_burst(self, x, y, (int)(96 * d), 70.f, 1.0f, 1); break;
+            default: break;
+        }
+    }
+}
+
+typedef struct particle_step {
+    ParticlePool* pool;
+    float32 dt;
+} ParticleStep;
+
+void particles_update(ParticlePool* self, JobSystem* jobs, float32 dt) {
+    ParticleStep step = { self, dt };
+    job_parallel_for(jobs, (self->count + 3) / 4, PARTICLE_JOB_BATCHES, particles_integrate_job, &step);
+    particles_compact(self);
+}
+
+// Job ranges are in batches of 4 so the SSE2 path stays aligned to them
+void particles_integrate_job(void* data, int begin, int end) {
+    ParticleStep* step = (ParticleStep*)data;
+    particles_integrate(step->pool, begin * 4, SDL_min(end * 4, step->pool->count), step->dt);
+}
+
+// Advances particles [begin, end), four at a time where SSE2 is available.
+// Slots past count are garbage but allocated, so the last batch may run over.
+void particles_integrate(ParticlePool* self, int begin, int end, float32 dt) {
+    int count = end;
+    int i = begin;
+
+#ifdef VASION_SSE2
+    const __m128 vdt = _mm_set1_ps(dt);
+    const __m128 vg = _mm_set1_ps(PARTICLE_GRAVITY * dt);
+    for (; i < count; i += 4) {
+        __m128 vy = _mm_add_ps(_mm_loadu_ps(self->vy + i), vg);
+        __m128 vx = _mm_loadu_ps(self->vx + i);
+        _mm_storeu_ps(self->vy + i, vy);
+        _mm_storeu_ps(self->x + i, _mm_add_ps(_mm_loadu_ps(self->x + i), _mm_mul_ps(vx, vdt)));
+        _mm_storeu_ps(self->y + i, _mm_add_ps(_mm_loadu_ps(self->y + i), _mm_mul_ps(vy, vdt)));
+        _mm_storeu_ps(self->life + i, _mm_sub_ps(_mm_loadu_ps(self->life + i), vdt));
+    }
+#endif
+
+    for (; i < count; ++i) {
+        self->vy[i] += PARTICLE_GRAVITY * dt;
+        self->x[i] += self->vx[i] * dt;
+        self->y[i] += self->vy[i] * dt;
+        self->life[i] -= dt;
+    }
+}
+
+// Swap-removes expired and off-screen particles, no ordering is kept
+void particles_compact(ParticlePool* self) {
+    int i = 0;
+    while (i < self->count) {
+        if (self->life[i] > 0.f && self->y[i] < (float32)cScreenHeight &&
+            self->x[i] >= 0.f && self->x[i] < (float32)cScreenWidth) {
+            ++i;
+            continue;
+        }
+        int last = --self->count;
+        self->x[i] = self->x[last];
+        self->y[i] = self->y[last];
+        self->vx[i] = self->vx[last];
+        self->vy[i] = self->vy[last];
+        self->life[i] = self->life[last];
+        self->color[i] = self->color[last];
+    }
+}
+
+// One point batch per palette color: the first color fills points from the
+// front, the second from the back
+void particles_render(ParticlePool* self, SDL_Renderer* renderer, const SDL_Color* palette) {
+    int front = 0;
+    int back = MAX_PARTICLES;
+    for (int i = 0; i < self->count; ++i) {
+        SDL_Point p = { (int)self->x[i], (int)self->y[i] };
+        if (self->color[i] == 1) {
+            self->points[front++] = p;
+        }
+        else {
+            self->points[--back] = p;
+        }
+    }
+
+    if (front > 0) {
+        SDL_SetRenderDrawColor(renderer, palette[0].r, palette[0].g, palette[0].b, palette[0].a);
+        SDL_RenderDrawPoints(renderer, self->points, front);
+    }
+    if (back < MAX_PARTICLES) {
+        SDL_SetRenderDrawColor(renderer, palette[1].r, palette[1].g, palette[1].b, palette[1].a);
+        SDL_RenderDrawPoints(renderer, self->points + back, MAX_PARTICLES - back);
+    }
+}
+
+// Starts workerCount threads to help the calling thread. None means no
+// system at all, and everything runs inline.
+JobSystem* job_system_create(int workerCount) {
+    workerCount = SDL_min(workerCount, MAX_JOB_WORKERS);
+    if (workerCount <= 0) {
+        return NULL;
+    }
+
+    JobSystem* self = (JobSystem*)calloc(1, sizeof(JobSystem));
+    self->workerCount = workerCount;
+    self->wake = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&self->running, 1);
+    for (int i = 0; i < workerCount; ++i) {
+        self->threadInfo[i].system = self;
+        self->threadInfo[i].index = i;
+        self->threads[i] = SDL_CreateThread(job_worker, "vasion job", &self->threadInfo[i]);
+    }
+    return self;
+}
+
+void job_system_destroy(JobSystem* self) {
+    SDL_AtomicSet(&self->running, 0);
+    for (int i = 0; i < self->workerCount; ++i) {
+        SDL_SemPost(self->wake);
+    }
+    for (int i = 0; i < self->workerCount; ++i) {
+        SDL_WaitThread(self->threads[i], NULL);
+    }
+    SDL_DestroySemaphore(self->wake);
+    free(self);
+}
+
+// Runs func over [0, count) in slices of at least grain and returns once all
+// of them are done. The caller keeps working the whole time.
+void job_parallel_for(JobSystem* self, int count, int grain, JobFunc func, void* data) {
+    if (count <= 0) {
+        return;
+    }
+    if (!self || count <= grain) {
+        func(data, 0, count);
+        return;
+    }
+
+    SDL_atomic_t pending;
+    SDL_AtomicSet(&pending, count);
+    Job job = { func, data, 0, count, grain, &pending };
+    int owner = self->workerCount;
+    job_execute(self, owner, job);
+    while (SDL_AtomicGet(&pending) > 0) {
+        if (job_find(self, owner, &job)) {
+            job_execute(self, owner, job);
+        }
+    }
+}
+
+void job_execute(JobSystem* self, int thread, Job job) {
+    JobDeque* own = &self->deques[thread];
+    while (job.end - job.begin > job.grain) {
+        Job half = job;
+        half.begin = job.begin + (job.end - job.begin) / 2;
+        if (!job_deque_push(own, &half)) {
+            break;
+        }
+        job.end = half.begin;
+        if (SDL_AtomicGet(&self->sleeping) > 0) {
+            SDL_SemPost(self->wake);
+        }
+    }
+    job.func(job.data, job.begin, job.end);
+    SDL_AtomicAdd(job.pending, job.begin - job.end);
+}
+
+// Own work first, newest first while it's still in cache, then steal the
+// oldest (biggest) slice from someone else
+bool job_find(JobSystem* self, int thread, Job* out) {
+    if (job_deque_pop(&self->deques[thread], out)) {
+        return true;
+    }
+    int threadCount = self->workerCount + 1;
+    for (int i = 1; i < threadCount; ++i) {
+        if (job_deque_steal(&self->deques[(thread + i) % threadCount], out)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Indices only grow; their difference is what counts, so wrapping is fine
+bool job_deque_push(JobDeque* self, const Job* job) {
+    int bottom = self->bottom.value;
+    int top = SDL_AtomicGet(&self->top);
+    if ((int)((uint32)bottom - (uint32)top) >= JOB_DEQUE_SIZE) {
+        return false;
+    }
+    self->jobs[bottom & (JOB_DEQUE_SIZE - 1)] = *job;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&self->bottom, bottom + 1);
+    return true;
+}
+
+bool job_deque_pop(JobDeque* self, Job* out) {
+    // the decrement has to be visible before top is read, a full barrier
+    int bottom = SDL_AtomicAdd(&self->bottom, -1) - 1;
+    int top = SDL_AtomicGet(&self->top);
+    int size = (int)((uint32)bottom - (uint32)top);
+    if (size < 0) {
+        SDL_AtomicSet(&self->bottom, bottom + 1);
+        return false;
+    }
+
+    *out = self->jobs[bottom & (JOB_DEQUE_SIZE - 1)];
+    if (size > 0) {
+        return true;
+    }
+
+    // last job, thieves may be after it too
+    bool won = SDL_AtomicCAS(&self->top, top, top + 1);
+    SDL_AtomicSet(&self->bottom, bottom + 1);
+    return won;
+}
+
+bool job_deque_steal(JobDeque* self, Job* out) {
+    int top = SDL_AtomicGet(&self->top);
+    SDL_MemoryBarrierAcquire();
+    int bottom = SDL_AtomicGet(&self->bottom);
+    if ((int)((uint32)bottom - (uint32)top) <= 0) {
+        return false;
+    }
+    // may be mid-overwrite, in which case the CAS fails and it's discarded
+    *out = self->jobs[top & (JOB_DEQUE_SIZE - 1)];
+    return SDL_AtomicCAS(&self->top, top, top + 1);
+}
+
+int job_worker(void* data) {
+    JobThread* thread = (JobThread*)data;
+    JobSystem* self = thread->system;
+    int idle = 0;
+    while (SDL_AtomicGet(&self->running)) {
+        Job job;
+        if (job_find(self, thread->index, &job)) {
+            job_execute(self, thread->index, job);
+            idle = 0;
+            continue;
+        }
+
+        // parallel-fors come in bursts, so spin a little before sleeping
+        if (++idle < 256) {
+            continue;
+        }
+        SDL_AtomicAdd(&self->sleeping, 1);
+        SDL_SemWaitTimeout(self->wake, 10);
+        SDL_AtomicAdd(&self->sleeping, -1);
+    }
+    return 0;
+}
+
+void options_parse(Options* self, int argc, char* argv[]) {
+    self->software = false;
+    self->scanlines = false;
+    self->capturePath = NULL;
+    self->decodeInputPath = NULL;
+    self->decodeOutputPrefix = NULL;
+    self->seed = (uint32)time(NULL);
+    self->soakSeconds = 0;
+    self->soakThreads = 0;
+    self->soakEpisodeTicks = 10 * 60 * SIM_TICK_RATE;
+    self->soakSessions = 0;
+    self->soakRepro = false;
+    self->soakReproTicks = 0;
+    self->serverPort = 0;
+    self->connectAddress = NULL;
+    self->netLatencyMs = 0;
+    self->netJitterMs = 0;
+    self->netLossPercent = 0;
+    self->netLoopbackSeconds = 0;
+    self->feedName = NULL;
+    self->feedReadName = NULL;
+    self->feedReadSeconds = 0;
+    self->jobThreads = 0;
+    self->stress = false;
+    self->scriptBenchTasks = 0;
+    self->scriptBenchSeconds = 0;
+    self->jobsBenchTicks = 0;
+    self->recordPath = NULL;
+    self->replayPath = NULL;
+    self->bot = false;
+    self->turbo = false;
+    self->turboSpeed = 0;
+    self->historySeconds = HISTORY_SECONDS;
+    self->hitchMs = HITCH_MS;
+    self->hitchDir = NULL;
+    self->renderInputPath = NULL;
+    self->renderOutputPrefix = NULL;
+    self->frameBudgetMs = -1;
+    self->bakeSpritesPath = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--software") == 0) {
+            self->software = true;
+        }
+        else if (strcmp(argv[i], "--scanlines") == 0) {
+            self->scanlines = true;
+        }
+        else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+            self->capturePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            self->seed = (uint32)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--soak") == 0 && i + 1 < argc) {
+            self->soakSeconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--soak-threads") == 0 && i + 1 < argc) {
+            self->soakThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--soak-sessions") == 0 && i + 1 < argc) {
+            self->soakSessions = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--soak-episode") == 0 && i + 1 < argc) {
+            self->soakEpisodeTicks = (uint32)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--soak-repro") == 0 && i + 2 < argc) {
+            self->soakRepro = true;
+            self->seed = (uint32)strtoul(argv[++i], NULL, 10);
+            self->soakReproTicks = (uint32)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--decode-capture") == 0 && i + 2 < argc) {
+            self->decodeInputPath = argv[++i];
+            self->decodeOutputPrefix = argv[++i];
+        }
+        else if (strcmp(argv[i], "--server") == 0 && i + 1 < argc) {
+            self->serverPort = (uint16)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc) {
+            self->connectAddress = argv[++i];
+        }
+        else if (strcmp(argv[i], "--net-latency") == 0 && i + 1 < argc) {
+            self->netLatencyMs = (uint32)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--net-jitter") == 0 && i + 1 < argc) {
+            self->netJitterMs = (uint32)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--net-loss") == 0 && i + 1 < argc) {
+            self->netLossPercent = (uint32)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--net-loopback") == 0 && i + 1 < argc) {
+            self->netLoopbackSeconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            self->jobThreads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--feed") == 0 && i + 1 < argc) {
+            self->feedName = argv[++i];
+        }
+        else if (strcmp(argv[i], "--feed-read") == 0 && i + 2 < argc) {
+            self->feedReadName = argv[++i];
+            self->feedReadSeconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--stress") == 0) {
+            self->stress = true;
+        }
+        else if (strcmp(argv[i], "--script-bench") == 0 && i + 2 < argc) {
+            self->scriptBenchTasks = atoi(argv[++i]);
+            self->scriptBenchSeconds = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--jobs-bench") == 0 && i + 1 < argc) {
+            self->jobsBenchTicks = (uint32)strtoul(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            self->recordPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            self->replayPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bot") == 0) {
+            self->bot = true;
+        }
+        else if (strcmp(argv[i], "--bake-sprites") == 0 && i + 1 < argc) {
+            self->bakeSpritesPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--render-replay") == 0 && i + 2 < argc) {
+            self->renderInputPath = argv[++i];
+            self->renderOutputPrefix = argv[++i];
+        }
+        else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) {
+            self->frameBudgetMs = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--hitch-ms") == 0 && i + 1 < argc) {
+            self->hitchMs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--hitch-dir") == 0 && i + 1 < argc) {
+            self->hitchDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "--history") == 0 && i + 1 < argc) {
+            self->historySeconds = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--turbo") == 0 && i + 1 < argc) {
+            self->turbo = true;
+            self->turboSpeed = (uint32)strtoul(argv[++i], NULL, 10);
+        }
+    }
+}
+
+bool display_init(Display* self, SDL_Window* window, Options* options) {
+    self->window = window;
+    self->renderer = NULL;
+    self->screenTexture = NULL;
+    self->frame = NULL;
+    self->software = options->software;
+    self->scanlines = options->scanlines;
+    self->windowWidth = 0;
+    self->windowHeight = 0;
+
+    if (!self->software) {
+        self->renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE);
+
+        // a software renderer on the window means every present is a render
+        // target round trip plus a scaled copy on the cpu, avoid it
+        SDL_RendererInfo info;
+        if (self->renderer && SDL_GetRendererInfo(self->renderer, &info) == 0 && (info.flags & SDL_RENDERER_SOFTWARE)) {
+            SDL_DestroyRenderer(self->renderer);
+            self->renderer = NULL;
+        }
+        self->software = (self->renderer == NULL);
+    }
+
+    if (!self->software) {
+        self->screenTexture = SDL_CreateTexture(self->renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, cScreenWidth, cScreenHeight);
+        SDL_RenderSetLogicalSize(self->renderer, cScreenWidth, cScreenHeight);
+        return true;
+    }
+
+    // match the window surface format so presenting never converts pixels
+    SDL_Surface* windowSurface = SDL_GetWindowSurface(window);
+    uint32 format = SDL_PIXELFORMAT_ARGB8888;
+    if (windowSurface && windowSurface->format->BytesPerPixel == 4) {
+        format = windowSurface->format->format;
+    }
+
+    self->frame = SDL_CreateRGBSurfaceWithFormat(0, cScreenWidth, cScreenHeight, 32, format);
+    if (!self->frame) {
+        return false;
+    }
+    self->renderer = SDL_CreateSoftwareRenderer(self->frame);
+    return self->renderer != NULL;
+}
+
+void display_shutdown(Display* self) {
+    if (self->screenTexture) {
+        SDL_DestroyTexture(self->screenTexture);
+        self->screenTexture = NULL;
+    }
+    if (self->renderer) {
+        SDL_DestroyRenderer(self->renderer);
+        self->renderer = NULL;
+    }
+    if (self->frame) {
+        SDL_FreeSurface(self->frame);
+        self->frame = NULL;
+    }
+}
+
+void display_begin_frame(Display* self) {
+    if (!self->software) {
+        SDL_SetRenderTarget(self->renderer, self->screenTexture);
+    }
+    SDL_SetRenderDrawColor(self->renderer, 32, 32, 48, 255);
+    SDL_RenderClear(self->renderer);
+}
+
+void display_present(Display* self) {
+    if (self->software) {
+        display_present_software(self);
+        return;
+    }
+
+    // render the render texture to the window
+    SDL_SetRenderTarget(self->renderer, NULL);
+
+    SDL_SetRenderDrawColor(self->renderer, 0, 0, 0, 255);
+    //SDL_RenderClear(renderer);
+    SDL_RenderCopy(self->renderer, self->screenTexture, NULL, NULL);
+
+    SDL_RenderPresent(self->renderer);
+}
+
+void display_present_software(Display* self) {
+    SDL_Surface* surface = SDL_GetWindowSurface(self->window);
+    if (!surface) {
+        return;
+    }
+
+    int scale = SDL_min(surface->w / cScreenWidth, surface->h / cScreenHeight);
+    if (scale < 1) {
+        scale = 1;
+    }
+    SDL_Rect dest = {
+        (surface->w - cScreenWidth * scale) / 2,
+        (surface->h - cScreenHeight * scale) / 2,
+        cScreenWidth * scale,
+        cScreenHeight * scale,
+    };
+
+    // letterbox borders only need clearing when the window changes size
+    bool resized = (surface->w != self->windowWidth || surface->h != self->windowHeight);
+    if (resized) {
+        SDL_FillRect(surface, NULL, SDL_MapRGB(surface->format, 0, 0, 0));
+        self->windowWidth = surface->w;
+        self->windowHeight = surface->h;
+    }
+
+    if (surface->format->format != self->frame->format->format || dest.x < 0 || dest.y < 0) {
+        SDL_BlitScaled(self->frame, NULL, surface, &dest);
+        SDL_UpdateWindowSurface(self->window);
+        return;
+    }
+
+    if (SDL_MUSTLOCK(surface)) {
+        SDL_LockSurface(surface);
+    }
+
+    // expand each source row once, then replicate it down with plain copies
+    int dstPitch = surface->pitch / 4;
+    uint32* dstRow = (uint32*)surface->pixels + dest.y * dstPitch + dest.x;
+    for (int y = 0; y < cScreenHeight; ++y) {
+        const uint32* srcRow = (const uint32*)((uint8*)self->frame->pixels + y * self->frame->pitch);
+        display_expand_row(dstRow, srcRow, cScreenWidth, scale);
+
+        int copies = scale - 1;
+        if (self->scanlines && scale > 1) {
+            --copies;
+        }
+        for (int i = 1; i <= copies; ++i) {
+            SDL_memcpy(dstRow + i * dstPitch, dstRow, dest.w * sizeof(uint32));
+        }
+        if (self->scanlines && scale > 1) {
+            display_darken_row(dstRow + (scale - 1) * dstPitch, dstRow, dest.w);
+        }
+        dstRow += scale * dstPitch;
+    }
+
+    if (SDL_MUSTLOCK(surface)) {
+        SDL_UnlockSurface(surface);
+    }
+
+    if (resized) {
+        SDL_UpdateWindowSurface(self->window);
+    }
+    else {
+        SDL_UpdateWindowSurfaceRects(self->window, &dest, 1);
+    }
+}
+
+void display_expand_row(uint32* dst, const uint32* src, int width, int scale) {
+    int x = 0;
+#ifdef VASION_SSE2
+    if (scale == 2) {
+        for (; x + 4 <= width; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+            _mm_storeu_si128((__m128i*)(dst + x * 2), _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i*)(dst + x * 2 + 4), _mm_unpackhi_epi32(v, v));
+        }
+    }
+    else if (scale >= 4) {
+        for (; x < width; ++x) {
+            __m128i v = _mm_set1_epi32((int)src[x]);
+            uint32* out = dst + x * scale;
+            int i = 0;
+            for (; i + 4 <= scale; i += 4) {
+                _mm_storeu_si128((__m128i*)(out + i), v);
+            }
+            for (; i < scale; ++i) {
+                out[i] = src[x];
+            }
+        }
+    }
+#endif
+    for (; x < width; ++x) {
+        uint32 p = src[x];
+        uint32* out = dst + x * scale;
+        for (int i = 0; i < scale; ++i) {
+            out[i] = p;
+        }
+    }
+}
+
+void display_darken_row(uint32* dst, const uint32* src, int width) {
+    // 3/4 brightness per channel without unpacking: p/2 + p/4
+    int x = 0;
+#ifdef VASION_SSE2
+    __m128i mask1 = _mm_set1_epi32(0x7f7f7f7f);
+    __m128i mask2 = _mm_set1_epi32(0x3f3f3f3f);
+    for (; x + 4 <= width; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i half = _mm_and_si128(_mm_srli_epi32(v, 1), mask1);
+        __m128i quarter = _mm_and_si128(_mm_srli_epi32(v, 2), mask2);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_add_epi32(half, quarter));
+    }
+#endif
+    for (; x < width; ++x) {
+        uint32 p = src[x];
+        dst[x] = ((p >> 1) & 0x7f7f7f7f) + ((p >> 2) & 0x3f3f3f3f);
+    }
+}
+
+void frame_rasterize(GameState* state, uint8* pixels) {
+    SDL_memset(pixels, 0, SCREEN_PIXELS);
+
+    // same order as game_render
+    int tankTexture = (state->play.tank.mode == TankMode_Dead) ? cExplosionTexture : cTankTexture;
+    frame_blit(pixels, &cSprites[tankTexture], &state->play.tank.target);
+
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        Sprite shieldSprite = shield_sprite(&state->play.shields[i]);
+        frame_blit(pixels, &shieldSprite, &state->play.shields[i].target);
+    }
+
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        InvaderState* invader = &state->play.invaders[i];
+        if (invader->active) {
+            int textureIndex = cInvaderTextureTable[invader->invaderType] + (invader->frame & 0x1);
+            Rect rect = invader_hit_rect(invader);
+            frame_blit(pixels, &cSprites[textureIndex], &rect);
+        }
+        else if (invader->deathTime > 0) {
+            frame_blit(pixels, &cSprites[cExplosionTexture], &invader->target);
+        }
+    }
+
+    UfoState* ufo = &state->play.ufo;
+    if (ufo->active || ufo->deathTime > 0) {
+        frame_blit(pixels, &cSprites[ufo->active ? cUfoTexture : cExplosionTexture], &ufo->target);
+    }
+
+    for (int i = 0; i < MAX_BULLETS; ++i) {
+        BulletState* bullet = &state->play.bullets[i];
+        if (bullet->active) {
+            int texIdx = bullet->baseTexture + ((bullet->frame / 30) % bullet->frameCount);
+            frame_blit(pixels, &cSprites[texIdx], &bullet->target);
+        }
+    }
+
+    hud_rasterize(&state->play, pixels);
+}
+
+void frame_blit(uint8* pixels, const Sprite* sprite, Rect* rect) {
+    SDL_Rect r;
+    rect_to_sdl(rect, &r);
+
+    int x0 = SDL_max(r.x, 0);
+    int y0 = SDL_max(r.y, 0);
+    int x1 = SDL_min(r.x + sprite->width, SCREEN_WIDTH);
+    int y1 = SDL_min(r.y + sprite->height, SCREEN_HEIGHT);
+
+    for (int y = y0; y < y1; ++y) {
+        const uint8* src = sprite->data + (y - r.y) * sprite->width;
+        uint8* dst = pixels + y * SCREEN_WIDTH;
+        for (int x = x0; x < x1; ++x) {
+            uint8 value = src[x - r.x];
+            if (value) {
+                dst[x] = value;
+            }
+        }
+    }
+}
+
+uint8* write_varint(uint8* out, uint32 value) {
+    while (value >= 0x80) {
+        *out++ = (uint8)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8)value;
+    return out;
+}
+
+const uint8* read_varint(const uint8* in, const uint8* end, uint32* value) {
+    uint32 result = 0;
+    int shift = 0;
+    while (in < end && shift < 32) {
+        uint8 b = *in++;
+        result |= (uint32)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *value = result;
+            return in;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+// Encodes curr ^ prev as repeated (zero run, literal count, literals) records.
+// A NULL prev encodes against zeros, which is how keyframes are stored. The
+// output never exceeds size * 2 bytes.
+int xor_rle_encode(const uint8* curr, const uint8* prev, int size, uint8* out) {
+    uint8* start = out;
+    int i = 0;
+    while (i < size) {
+        // skip unchanged bytes a vector or word at a time where possible
+        int zeroStart = i;
+        if (prev) {
+#ifdef VASION_SSE2
+            while (i + 16 <= size) {
+                __m128i a = _mm_loadu_si128((const __m128i*)(curr + i));
+                __m128i b = _mm_loadu_si128((const __m128i*)(prev + i));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff) {
+                    break;
+                }
+                i += 16;
+            }
+#endif
+            while (i + 8 <= size) {
+                uint64 a, b;
+                SDL_memcpy(&a, curr + i, 8);
+                SDL_memcpy(&b, prev + i, 8);
+                if (a != b) {
+                    break;
+                }
+                i += 8;
+            }
+        }
+        while (i < size && curr[i] == (prev ? prev[i] : 0)) {
+            ++i;
+        }
+        int zeros = i - zeroStart;
+
+        // literals absorb gaps shorter than 3 bytes, a new record is cheaper after that
+        int literalStart = i;
+        while (i < size) {
+            if (curr[i] != (prev ? prev[i] : 0)) {
+                ++i;
+                continue;
+            }
+            int gap = 0;
+            while (i + gap < size && gap < 3 && curr[i + gap] == (prev ? prev[i + gap] : 0)) {
+                ++gap;
+            }
+            if (gap >= 3 || i + gap == size) {
+                break;
+            }
+            i += gap;
+        }
+        int literals = i - literalStart;
+
+        out = write_varint(out, (uint32)zeros);
+        out = write_varint(out, (uint32)literals);
+        for (int j = literalStart; j < i; ++j) {
+            *out++ = curr[j] ^ (prev ? prev[j] : 0);
+        }
+    }
+    return (int)(out - start);
+}
+
+// XORs an encoded stream into buffer, turning the previous frame into the
+// next one in place.
+bool xor_rle_decode(const uint8* in, int inSize, uint8* buffer, int size) {
+    const uint8* end = in + inSize;
+    int pos = 0;
+    while (in < end) {
+        uint32 zeros, literals;
+        in = read_varint(in, end, &zeros);
+        if (!in) return false;
+        in = read_varint(in, end, &literals);
+        if (!in) return false;
+
+        if (zeros > (uint32)(size - pos)) return false;
+        pos += zeros;
+        if (literals > (uint32)(size - pos) || literals > (uint32)(end - in)) return false;
+        for (uint32 j = 0; j < literals; ++j) {
+            buffer[pos++] ^= *in++;
+        }
+    }
+    return pos == size;
+}
+
+void put_u16(uint8* out, uint16 v) {
+    out[0] = (uint8)v;
+    out[1] = (uint8)(v >> 8);
+}
+
+void put_u32(uint8* out, uint32 v) {
+    out[0] = (uint8)v;
+    out[1] = (uint8)(v >> 8);
+    out[2] = (uint8)(v >> 16);
+    out[3] = (uint8)(v >> 24);
+}
+
+uint16 get_u16(const uint8* in) {
+    return (uint16)(in[0] | (in[1] << 8));
+}
+
+uint32 get_u32(const uint8* in) {
+    return (uint32)in[0] | ((uint32)in[1] << 8) | ((uint32)in[2] << 16) | ((uint32)in[3] << 24);
+}
+
+CaptureState* capture_start(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        SDL_Log("capture: could not open %s", path);
+        return NULL;
+    }
+
+    // header: magic, version, size, palette (index 0 is the background)
+    uint8 header[16 + 3 * 3];
+    SDL_memcpy(header, "VCAP", 4);
+    put_u16(header + 4, CAPTURE_VERSION);
+    put_u16(header + 6, SCREEN_WIDTH);
+    put_u16(header + 8, SCREEN_HEIGHT);
+    put_u16(header + 10, 3);
+    put_u32(header + 12, CAPTURE_KEYFRAME_INTERVAL);
+    SDL_Color colors[3] = { cCaptureBackground, cColorPalette[0], cColorPalette[1] };
+    for (int i = 0; i < 3; ++i) {
+        header[16 + i * 3 + 0] = colors[i].r;
+        header[16 + i * 3 + 1] = colors[i].g;
+        header[16 + i * 3 + 2] = colors[i].b;
+    }
+    fwrite(header, sizeof(header), 1, file);
+
+    CaptureState* self = (CaptureState*)malloc(sizeof(CaptureState));
+    if (!self) {
+        fclose(file);
+        return NULL;
+    }
+    self->file = file;
+    self->ready = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&self->head, 0);
+    SDL_AtomicSet(&self->tail, 0);
+    SDL_AtomicSet(&self->running, 1);
+    self->prev = self->buffers[0];
+    self->curr = self->buffers[1];
+    self->frame = 0;
+    self->dropped = 0;
+    self->thread = SDL_CreateThread(capture_writer, "capture", self);
+    return self;
+}
+
+void capture_stop(CaptureState* self) {
+    SDL_AtomicSet(&self->running, 0);
+    SDL_SemPost(self->ready);
+    SDL_WaitThread(self->thread, NULL);
+
+    fclose(self->file);
+    SDL_DestroySemaphore(self->ready);
+    if (self->dropped > 0) {
+        SDL_Log("capture: dropped %u of %u frames", self->dropped, self->frame);
+    }
+    free(self);
+}
+
+// A frame the game had no time to capture, the next one deltas past it
+void capture_skip(CaptureState* self) {
+    self->frame++;
+    self->dropped++;
+}
+
+void capture_frame(CaptureState* self, GameState* state) {
+    int head = SDL_AtomicGet(&self->head);
+    int tail = SDL_AtomicGet(&self->tail);
+    uint32 frame = self->frame++;
+    if (head - tail >= CAPTURE_QUEUE_SIZE) {
+        // writer is behind, the next frame will delta against the last one sent
+        ++self->dropped;
+        return;
+    }
+
+    CaptureSlot* slot = &self->slots[head & (CAPTURE_QUEUE_SIZE - 1)];
+    frame_rasterize(state, self->curr);
+
+    slot->frame = frame;
+    slot->timeMs = SDL_GetTicks();
+    slot->keyframe = (head % CAPTURE_KEYFRAME_INTERVAL) == 0;
+    slot->size = xor_rle_encode(self->curr, slot->keyframe ? NULL : self->prev, SCREEN_PIXELS, slot->data);
+
+    uint8* swap = self->prev;
+    self->prev = self->curr;
+    self->curr = swap;
+
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&self->head, head + 1);
+    SDL_SemPost(self->ready);
+}
+
+int capture_writer(void* data) {
+    CaptureState* self = (CaptureState*)data;
+    for (;;) {
+        SDL_SemWait(self->ready);
+
+        int tail = SDL_AtomicGet(&self->tail);
+        int head = SDL_AtomicGet(&self->head);
+        if (tail == head) {
+            if (!SDL_AtomicGet(&self->running)) {
+                break;
+            }
+            continue;
+        }
+        SDL_MemoryBarrierAcquire();
+
+        CaptureSlot* slot = &self->slots[tail & (CAPTURE_QUEUE_SIZE - 1)];
+        uint8 header[13];
+        put_u32(header + 0, slot->frame);
+        put_u32(header + 4, slot->timeMs);
+        header[8] = slot->keyframe ? 1 : 0;
+        put_u32(header + 9, (uint32)slot->size);
+        fwrite(header, sizeof(header), 1, self->file);
+        fwrite(slot->data, slot->size, 1, self->file);
+
+        SDL_AtomicSet(&self->tail, tail + 1);
+    }
+    return 0;
+}
+
+int capture_decode(const char* path, const char* outputPrefix) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        SDL_Log("decode: could not open %s", path);
+        return 1;
+    }
+
+    uint8 header[16 + 3 * 3];
+    if (fread(header, sizeof(header), 1, file) != 1 || SDL_memcmp(header, "VCAP", 4) != 0 ||
+        get_u16(header + 4) != CAPTURE_VERSION || get_u16(header + 10) != 3) {
+        SDL_Log("decode: %s is not a capture file", path);
+        fclose(file);
+        return 1;
+    }
+    int width = get_u16(header + 6);
+    int height = get_u16(header + 8);
+
+    if (width != SCREEN_WIDTH || height != SCREEN_HEIGHT) {
+        SDL_Log("decode: %s is %dx%d, this build is %dx%d", path, width, height, SCREEN_WIDTH, SCREEN_HEIGHT);
+        fclose(file);
+        return 1;
+    }
+    SDL_Color colors[3];
+    for (int i = 0; i < 3; ++i) {
+        colors[i].r = header[16 + i * 3 + 0];
+        colors[i].g = header[16 + i * 3 + 1];
+        colors[i].b = header[16 + i * 3 + 2];
+        colors[i].a = 255;
+    }
+    SDL_Surface* surface = frame_surface_create(colors, 3);
+
+    int size = width * height;
+    uint8* pixels = (uint8*)calloc(size, 1);
+    uint8* encoded = (uint8*)malloc(size * 2);
+
+    int count = 0;
+    uint8 frameHeader[13];
+    while (fread(frameHeader, sizeof(frameHeader), 1, file) == 1) {
+        bool keyframe = frameHeader[8] != 0;
+        uint32 encodedSize = get_u32(frameHeader + 9);
+        if (encodedSize > (uint32)size * 2 || fread(encoded, 1, encodedSize, file) != encodedSize) {
+            SDL_Log("decode: truncated frame %d", count);
+            break;
+        }
+        if (keyframe) {
+            SDL_memset(pixels, 0, size);
+        }
+        if (!xor_rle_decode(encoded, (int)encodedSize, pixels, size)) {
+            SDL_Log("decode: corrupt frame %d", count);
+            break;
+        }
+
+        char name[1024];
+        snprintf(name, sizeof(name), "%s%06u.bmp", outputPrefix, get_u32(frameHeader));
+        frame_save(surface, pixels, name);
+        ++count;
+    }
+
+    SDL_Log("decode: wrote %d frames", count);
+    free(encoded);
+    free(pixels);
+    SDL_FreeSurface(surface);
+    fclose(file);
+    return 0;
+}
+
+// An 8 bit surface the size of the screen for frame_save
+SDL_Surface* frame_surface_create(const SDL_Color* colors, int colorCount) {
+    SDL_Surface* surface = SDL_CreateRGBSurfaceWithFormat(0, SCREEN_WIDTH, SCREEN_HEIGHT, 8, SDL_PIXELFORMAT_INDEX8);
+    SDL_SetPaletteColors(surface->format->palette, colors, 0, colorCount);
+    return surface;
+}
+
+// Writes rasterized palette indices out as a BMP
+void frame_save(SDL_Surface* surface, const uint8* pixels, const char* path) {
+    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
+        SDL_memcpy((uint8*)surface->pixels + y * surface->pitch, pixels + y * SCREEN_WIDTH, SCREEN_WIDTH);
+    }
+    SDL_SaveBMP(surface, path);
+}
+
+int soak_run(Options* options) {
+    if (options->soakRepro) {
+        SoakSession* repro = (SoakSession*)calloc(1, sizeof(SoakSession));
+        soak_session_start(repro, options->seed);
+        const char* message = NULL;
+        while (!message && repro->tick < options->soakReproTicks) {
+            message = soak_session_step(repro);
+        }
+        if (!message) {
+            SDL_Log("soak: seed %u ran %u ticks clean", options->seed, options->soakReproTicks);
+        }
+        else {
+            SDL_Log("soak: seed %u failed at tick %u: %s (hash %016llx)", repro->seed, repro->tick,
+                message, (unsigned long long)play_hash(&repro->session.state.play));
+        }
+        session_free(&repro->session);
+        free(repro);
+        return message ? 1 : 0;
+    }
+
+    int threadCount = options->soakThreads > 0 ? options->soakThreads : SDL_GetCPUCount();
+    int sessionCount = SDL_max(options->soakSessions, threadCount);
+
+    SoakState soak;
+    soak.baseSeed = options->seed;
+    soak.episodeTicks = options->soakEpisodeTicks;
+    soak.sessionsPerWorker = (sessionCount + threadCount - 1) / threadCount;
+    uint64 start = SDL_GetPerformanceCounter();
+    soak.deadline = start + (uint64)(options->soakSeconds * SDL_GetPerformanceFrequency());
+    SDL_AtomicSet(&soak.nextEpisode, 0);
+    SDL_AtomicSet(&soak.failed, 0);
+
+    SoakWorker* workers = (SoakWorker*)calloc(threadCount, sizeof(SoakWorker));
+    for (int i = 0; i < threadCount; ++i) {
+        workers[i].soak = &soak;
+        workers[i].sessions = (SoakSession*)calloc(soak.sessionsPerWorker, sizeof(SoakSession));
+        workers[i].thread = SDL_CreateThread(soak_worker, "soak", &workers[i]);
+    }
+
+    uint64 ticks = 0;
+    uint32 episodes = 0;
+    for (int i = 0; i < threadCount; ++i) {
+        SDL_WaitThread(workers[i].thread, NULL);
+        ticks += workers[i].ticks;
+        episodes += workers[i].episodes;
+        for (int j = 0; j < soak.sessionsPerWorker; ++j) {
+            session_free(&workers[i].sessions[j].session);
+        }
+        free(workers[i].sessions);
+    }
+    free(workers);
+
+    float64 seconds = (float64)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    float64 playerHours = (float64)ticks / SIM_TICK_RATE / 3600.0;
+    SDL_Log("soak: %d threads, %d sessions of %u bytes, %u episodes, %llu ticks in %.1fs (%.0f ticks/s, %.1f player hours)",
+        threadCount, soak.sessionsPerWorker * threadCount, (uint32)(sizeof(Session) + SESSION_ARENA_BYTES), episodes,
+        (unsigned long long)ticks, seconds, ticks / seconds, playerHours);
+
+    if (SDL_AtomicGet(&soak.failed)) {
+        SDL_Log("soak: FAILED '%s' at seed %u tick %u", soak.failure.message, soak.failure.seed, soak.failure.tick);
+        SDL_Log("soak: reproduce with --soak-repro %u %u", soak.failure.seed, soak.failure.tick);
+        return 1;
+    }
+    return 0;
+}
+
+int soak_worker(void* data) {
+    SoakWorker* self = (SoakWorker*)data;
+    SoakState* soak = self->soak;
+    const int count = soak->sessionsPerWorker;
+
+    for (int i = 0; i < count; ++i) {
+        soak_session_start(&self->sessions[i], soak->baseSeed + (uint32)SDL_AtomicAdd(&soak->nextEpisode, 1));
+    }
+
+    while (!SDL_AtomicGet(&soak->failed) && SDL_GetPerformanceCounter() < soak->deadline) {
+        for (int i = 0; i < count; ++i) {
+            SoakSession* session = &self->sessions[i];
+            const char* message = soak_session_step(session);
+            self->ticks++;
+            if (message) {
+                if (SDL_AtomicCAS(&soak->failed, 0, 1)) {
+                    soak->failure.message = message;
+                    soak->failure.seed = session->seed;
+                    soak->failure.tick = session->tick;
+                }
+                return 0;
+            }
+            if (session->tick >= soak->episodeTicks) {
+                self->episodes++;
+                soak_session_start(session, soak->baseSeed + (uint32)SDL_AtomicAdd(&soak->nextEpisode, 1));
+            }
+        }
+    }
+    return 0;
+}
+
+// Starts a fresh game seeded with seed, played by random keys derived from
+// the same seed, so the first failing tick of a seed is the minimal repro.
+void soak_session_start(SoakSession* self, uint32 seed) {
+    session_init(&self->session, seed);
+    // odd seeds play versus with a random second player and every fourth
+    // pair of seeds plays the stress layout
+    self->session.config.versus = (seed & 1) != 0;
+    if ((seed & 0x6) == 0x6) {
+        self->session.config.stress = true;
+        play_reset(&self->session.state.play, &self->session.config);
+    }
+    rng_seed(&self->input, seed ^ 0x5bd1e995u);
+    self->move = 0;
+    self->seed = seed;
+    self->tick = 0;
+}
+
+// Advances one tick and returns the broken invariant, or NULL
+const char* soak_session_step(SoakSession* self) {
+    Session* session = &self->session;
+    GameState* state = &session->state;
+    self->tick++;
+
+    int kill = soak_bot_input(&self->input, &self->move, &state->play, &state->input,
+        self->remoteInput ? NULL : &state->remoteButtons);
+    if (kill >= 0) {
+        invader_kill(&state->play, &session->config, kill);
+    }
+
+    session_update(session, SIM_TICK_DT);
+    input_update(&state->input);
+
+    return play_check_invariants(&state->play);
+}
+
+// Plays the stress layout with that many extra tasks standing in for scripted
+// entities and reports what running them costs on top of a tick
+int script_bench_run(Options* options) {
+    int taskCount = options->scriptBenchTasks;
+    Session* session = (Session*)calloc(1, sizeof(Session));
+    session_init(session, options->seed);
+    session->config.stress = true;
+    play_reset(&session->state.play, &session->config);
+    PlayState* play = &session->state.play;
+
+    // allocated once up front, running them never allocates
+    ScriptTask* tasks = (ScriptTask*)calloc(taskCount, sizeof(ScriptTask));
+    for (int i = 0; i < taskCount; ++i) {
+        script_spawn(&tasks[i], 1, Script_Bench, i, play->tick);
+    }
+
+    uint64 frequency = SDL_GetPerformanceFrequency();
+    uint64 deadline = SDL_GetPerformanceCounter() + (uint64)(options->scriptBenchSeconds * frequency);
+    uint64 simTime = 0;
+    uint64 scriptTime = 0;
+    uint32 ticks = 0;
+    while (SDL_GetPerformanceCounter() < deadline) {
+        uint64 t0 = SDL_GetPerformanceCounter();
+        session_update(session, SIM_TICK_DT);
+        uint64 t1 = SDL_GetPerformanceCounter();
+
+        ScriptContext ctx;
+        ctx.play = play;
+        ctx.config = &session->config;
+        ctx.dt = SIM_TICK_DT;
+        ctx.tick = play->tick;
+        ctx.events = play->events.mask;
+        script_run(tasks, taskCount, &ctx);
+        uint64 t2 = SDL_GetPerformanceCounter();
+
+        simTime += t1 - t0;
+        scriptTime += t2 - t1;
+        ticks++;
+    }
+
+    uint64 resumes = 0;
+    for (int i = 0; i < taskCount; ++i) {
+        resumes += (uint16)tasks[i].counter;
+    }
+    float64 simNs = ticks ? (float64)simTime * 1e9 / frequency / ticks : 0;
+    float64 scriptNs = ticks ? (float64)scriptTime * 1e9 / frequency / ticks : 0;
+    SDL_Log("script bench: %d tasks of %d bytes, %u ticks, %llu loops", taskCount, (int)sizeof(ScriptTask),
+        ticks, (unsigned long long)resumes);
+    SDL_Log("script bench: stress tick %.1fus, tasks %.1fus per tick (%.2fns per task)",
+        simNs / 1000, scriptNs / 1000, taskCount ? scriptNs / taskCount : 0);
+
+    free(tasks);
+    session_free(session);
+    free(session);
+    return 0;
+}
+
+// Plays the same stress game for that many ticks at 1, 2, 4 and 8 job threads,
+// with an F5 particle burst every second so there is work worth handing out,
+// and reports each tick rate. Every run has to end on the same hash.
+int jobs_bench_run(Options* options) {
+    static const int cThreadCounts[] = { 1, 2, 4, 8 };
+    Session* session = (Session*)calloc(1, sizeof(Session));
+    ParticlePool* particles = (ParticlePool*)calloc(1, sizeof(ParticlePool));
+    GameState* state = &session->state;
+    const float32 dt = fx_to_float(SIM_TICK_DT);
+    uint64 frequency = SDL_GetPerformanceFrequency();
+    uint64 firstHash = 0;
+    float64 firstRate = 0;
+    int result = 0;
+
+    for (int run = 0; run < (int)SDL_arraysize(cThreadCounts); ++run) {
+        int threads = cThreadCounts[run];
+        session_init(session, options->seed);
+        session->config.stress = true;
+        play_reset(&state->play, &session->config);
+        session->jobs = job_system_create(threads - 1);
+        particles_init(particles, options->seed);
+        Rng input;
+        rng_seed(&input, options->seed ^ 0x5bd1e995u);
+        int move = 0;
+
+        uint64 start = SDL_GetPerformanceCounter();
+        for (uint32 tick = 0; tick < options->jobsBenchTicks; ++tick) {
+            int kill = soak_bot_input(&input, &move, &state->play, &state->input, &state->remoteButtons);
+            if (kill >= 0) {
+                invader_kill(&state->play, &session->config, kill);
+            }
+            session_update(session, SIM_TICK_DT);
+            input_update(&state->input);
+
+            if (tick % SIM_TICK_RATE == 0) {
+                particles_burst(particles, cScreenWidth / 2.f, cScreenHeight / 2.f, 20000, 90.f, 3.f, 1);
+            }
+            particles_post_events(particles, &state->play.events);
+            particles_update(particles, session->jobs, dt);
+        }
+        float64 seconds = (float64)(SDL_GetPerformanceCounter() - start) / frequency;
+        if (session->jobs) {
+            job_system_destroy(session->jobs);
+            session->jobs = NULL;
+        }
+
+        uint64 hash = hash_mix(play_hash(&state->play), (uint32)particles->count);
+        for (int i = 0; i < particles->count; ++i) {
+            uint32 x, y;
+            SDL_memcpy(&x, &particles->x[i], sizeof(x));
+            SDL_memcpy(&y, &particles->y[i], sizeof(y));
+            hash = hash_mix(hash_mix(hash, x), y);
+        }
+
+        float64 rate = options->jobsBenchTicks / seconds;
+        if (run == 0) {
+            firstHash = hash;
+            firstRate = rate;
+        }
+        SDL_Log("jobs bench: %d threads, %u ticks in %.2fs (%.0f ticks/s, %.2fx), hash %016llx", threads,
+            options->jobsBenchTicks, seconds, rate, rate / firstRate, (unsigned long long)hash);
+        if (hash != firstHash) {
+            SDL_Log("jobs bench: FAILED, %d threads ended on a different hash than 1", threads);
+            result = 1;
+        }
+    }
+
+    free(particles);
+    session_free(session);
+    free(session);
+    return result;
+}
+
+// The random player behind soak sessions and --bot. Sets this tick's keys and
+// returns an invader for the debug kill key, or -1. Player two is left alone
+// when remoteButtons is NULL, for games where it comes from the network.
+int soak_bot_input(Rng* rng, int* move, PlayState* play, InputState* input, uint8* remoteButtons) {
+    uint32 r = rng_next(rng);
+
+    // hold directions for a while like a player would, tap fire
+    if ((r & 0xf) == 0) {
+        *move = (int)((r >> 4) % 3) - 1;
+    }
+    input_set_key(input, KEY_LEFT, *move < 0);
+    input_set_key(input, KEY_RIGHT, *move > 0);
+    input_set_key(input, KEY_FIRE, ((r >> 8) & 0x3) == 0);
+    if (remoteButtons) {
+        *remoteButtons = (uint8)((r >> 24) & 0x7);
+    }
+
+    // the debug kill key, also exercises swarm removal outside of bullets
+    if (((r >> 12) & 0x1ff) != 0 || play->swarm.aliveCount == 0) {
+        return -1;
+    }
+    int index = (int)((r >> 21) % MAX_INVADERS);
+    while (!play->invaders[index].active) {
+        index = (index + 1) % MAX_INVADERS;
+    }
+    return index;
+}
+
+// The keys a tick reads, tank in the low bits and player two's above
+uint8 input_tick_buttons(InputState* input, uint8 remoteButtons) {
+    return (uint8)(input_get_key(input, KEY_LEFT) |
+        input_get_key(input, KEY_RIGHT) << 1 |
+        input_get_key(input, KEY_FIRE) << 2 |
+        (remoteButtons & 0x7) << 3);
+}
+
+void input_apply_tick_buttons(InputState* input, uint8* remoteButtons, uint8 buttons) {
+    input_set_key(input, KEY_LEFT, (buttons & 0x1) != 0);
+    input_set_key(input, KEY_RIGHT, (buttons & 0x2) != 0);
+    input_set_key(input, KEY_FIRE, (buttons & 0x4) != 0);
+    *remoteButtons = (buttons >> 3) & 0x7;
+}
+
+// start, when given, is where the recording plays from instead of a fresh
+// game. It is written as raw PlayState after its size, so only the same build
+// replays it and recording_open can tell when it's from another.
+Recording* recording_create(const char* path, uint32 seed, Config* config, const PlayState* start, uint8 startButtons) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        SDL_Log("record: could not open %s", path);
+        return NULL;
+    }
+
+    // header: magic, version, flags, seed
+    uint8 header[12];
+    SDL_memcpy(header, "VREC", 4);
+    put_u16(header + 4, RECORDING_VERSION);
+    put_u16(header + 6, (config->versus ? RECORDING_VERSUS : 0) | (config->stress ? RECORDING_STRESS : 0) |
+        (start ? RECORDING_STATE : 0));
+    put_u32(header + 8, seed);
+    fwrite(header, sizeof(header), 1, file);
+    if (start) {
+        uint8 size[4];
+        put_u32(size, (uint32)sizeof(PlayState));
+        fwrite(size, sizeof(size), 1, file);
+        fwrite(start, sizeof(PlayState), 1, file);
+        fputc(startButtons, file);
+    }
+
+    Recording* self = (Recording*)malloc(sizeof(Recording));
+    self->file = file;
+    self->ticks = 0;
+    self->start = NULL;
+    self->startButtons = 0;
+    return self;
+}
+
+// Opens a recording for replay, handing back the seed and the config flags
+// the session has to start from
+Recording* recording_open(const char* path, uint32* seed, Config* config) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        SDL_Log("replay: could not open %s", path);
+        return NULL;
+    }
+
+    uint8 header[12];
+    uint16 version = 0;
+    if (fread(header, sizeof(header), 1, file) != 1 || SDL_memcmp(header, "VREC", 4) != 0 ||
+        (version = get_u16(header + 4)) < 1 || version > RECORDING_VERSION) {
+        SDL_Log("replay: %s is not a recording", path);
+        fclose(file);
+        return NULL;
+    }
+    uint16 flags = get_u16(header + 6);
+    // a version 1 saved state can't be told apart from a shifted one
+    if ((flags & RECORDING_STATE) && version < 2) {
+        SDL_Log("replay: %s starts from a state saved by an older build", path);
+        fclose(file);
+        return NULL;
+    }
+    config->versus = (flags & RECORDING_VERSUS) != 0;
+    config->stress = (flags & RECORDING_STRESS) != 0;
+    *seed = get_u32(header + 8);
+
+    Recording* self = (Recording*)malloc(sizeof(Recording));
+    self->file = file;
+    self->ticks = 0;
+    self->start = NULL;
+    self->startButtons = 0;
+    if (flags & RECORDING_STATE) {
+        uint8 size[4];
+        if (fread(size, sizeof(size), 1, file) != 1 || get_u32(size) != sizeof(PlayState)) {
+            SDL_Log("replay: %s starts from a state saved by another build", path);
+            recording_close(self);
+            return NULL;
+        }
+        self->start = (PlayState*)malloc(sizeof(PlayState));
+        int buttons = EOF;
+        if (fread(self->start, sizeof(PlayState), 1, file) != 1 || (buttons = fgetc(file)) == EOF) {
+            SDL_Log("replay: %s is cut short", path);
+            recording_close(self);
+            return NULL;
+        }
+        self->startButtons = (uint8)buttons;
+    }
+    return self;
+}
+
+void recording_close(Recording* self) {
+    fclose(self->file);
+    free(self->start);
+    free(self);
+}
+
+void recording_write(Recording* self, uint8 buttons, int kill) {
+    fputc(buttons | (kill >= 0 ? RECORDING_KILL : 0), self->file);
+    if (kill >= 0) {
+        fputc(kill, self->file);
+    }
+    self->ticks++;
+}
+
+// False once the recording runs out
+bool recording_read(Recording* self, uint8* buttons, int* kill) {
+    int value = fgetc(self->file);
+    if (value == EOF) {
+        return false;
+    }
+    *buttons = (uint8)(value & ~RECORDING_KILL);
+    *kill = -1;
+    if (value & RECORDING_KILL) {
+        int index = fgetc(self->file);
+        if (index == EOF || index >= MAX_INVADERS) {
+            return false;
+        }
+        *kill = index;
+    }
+    self->ticks++;
+    return true;
+}
+
+// How many ticks to run this frame. Falling behind the wanted speed just
+// runs slower, it never builds up a backlog.
+int turbo_batch(TurboState* self, uint64 frameNs, uint64* accumulator, uint64 tickNs) {
+    uint64 drawNs = SDL_min(self->drawNs, TURBO_FRAME_NS - TURBO_MIN_BUDGET_NS);
+    uint64 fit = (TURBO_FRAME_NS - drawNs) / SDL_max(self->tickNs, 1);
+    fit = SDL_max(1, SDL_min(fit, TURBO_MAX_TICKS));
+    if (self->speed == 0) {
+        *accumulator = 0;
+        return (int)fit;
+    }
+
+    *accumulator += frameNs * self->speed;
+    uint64 wanted = *accumulator / tickNs;
+    if (wanted > fit) {
+        *accumulator = 0;
+        return (int)fit;
+    }
+    *accumulator -= wanted * tickNs;
+    return (int)wanted;
+}
+
+void turbo_measure(TurboState* self, int ticks, uint64 frameNs, uint64 simNs, uint64 drawNs, uint64 tickNs) {
+    if (ticks > 0) {
+        self->tickNs = (self->tickNs * 3 + simNs / ticks) / 4;
+    }
+    self->drawNs = (self->drawNs * 3 + drawNs) / 4;
+    self->simulatedNs += (uint64)ticks * tickNs;
+    self->elapsedNs += frameNs;
+    if (self->elapsedNs >= 500000000) {
+        self->achievedSpeed = (uint32)(self->simulatedNs / self->elapsedNs);
+        self->simulatedNs = 0;
+        self->elapsedNs = 0;
+    }
+}
+
+History* history_create(int seconds) {
+    History* self = (History*)calloc(1, sizeof(History));
+    self->tickCapacity = (uint32)seconds * SIM_TICK_RATE;
+    self->dataCapacity = self->tickCapacity * HISTORY_BYTES_PER_TICK;
+    if (!arena_init(&self->memory, self->tickCapacity * sizeof(HistoryTick) + self->dataCapacity +
+            sizeof(PlayState) * 3 + ARENA_ALIGN * 4)) {
+        free(self);
+        return NULL;
+    }
+    self->ticks = (HistoryTick*)arena_push(&self->memory, self->tickCapacity * sizeof(HistoryTick));
+    self->data = (uint8*)arena_push(&self->memory, self->dataCapacity);
+    self->prev = (PlayState*)arena_push(&self->memory, sizeof(PlayState));
+    self->encoded = (uint8*)arena_push(&self->memory, sizeof(PlayState) * 2);
+    return self;
+}
+
+void history_destroy(History* self) {
+    if (self->recorded > 0) {
+        uint32 used = self->count > 0 ? (self->head + self->dataCapacity - self->ticks[self->first].offset) % self->dataCapacity : 0;
+        SDL_Log("history: %u ticks held in %u of %u KB, %.2fus per tick recorded",
+            self->count, used / 1024, self->dataCapacity / 1024, (float64)self->recordNs / self->recorded / 1000.0);
+    }
+    arena_free(&self->memory);
+    free(self);
+}
+
+// Drops the oldest keyframe and the deltas that depend on it
+void history_evict(History* self) {
+    do {
+        self->first = (self->first + 1) % self->tickCapacity;
+        self->firstTick++;
+        self->count--;
+    } while (self->count > 0 && !self->ticks[self->first].keyframe);
+    if (self->count == 0) {
+        self->head = 0;
+    }
+}
+
+// Adds the tick just simulated. Costs a compare over the state, 16 bytes at a
+// time with SSE2 and 8 without, and a copy of it; the encoding is only as long
+// as what changed.
+void history_record(History* self, PlayState* play) {
+    uint64 start = SDL_GetPerformanceCounter();
+
+    if (self->count > 0 && play->tick != self->firstTick + self->count) {
+        // not the tick after the last one, start over from a keyframe
+        self->count = 0;
+        self->head = 0;
+    }
+    bool keyframe = self->count == 0 || self->sinceKeyframe + 1 >= HISTORY_KEYFRAME_TICKS;
+    int size = xor_rle_encode((const uint8*)play, keyframe ? NULL : (const uint8*)self->prev, sizeof(PlayState), self->encoded);
+
+    // find room in the data ring, evicting from the old end until it fits
+    if (self->count == self->tickCapacity) {
+        history_evict(self);
+    }
+    for (;;) {
+        if (self->count == 0) {
+            self->head = 0;
+            break;
+        }
+        uint32 tail = self->ticks[self->first].offset;
+        if (self->head >= tail) {
+            if (self->head + size <= self->dataCapacity) {
+                break;
+            }
+            if ((uint32)size < tail) {
+                self->head = 0;
+                break;
+            }
+        }
+        else if (self->head + size < tail) {
+            break;
+        }
+        history_evict(self);
+    }
+    if (self->count == 0) {
+        // the oldest tick held must be a keyframe
+        self->firstTick = play->tick;
+        if (!keyframe) {
+            keyframe = true;
+            size = xor_rle_encode((const uint8*)play, NULL, sizeof(PlayState), self->encoded);
+        }
+    }
+
+    HistoryTick* tick = &self->ticks[(self->first + self->count) % self->tickCapacity];
+    tick->offset = self->head;
+    tick->size = (uint16)size;
+    tick->keyframe = keyframe;
+    SDL_memcpy(self->data + self->head, self->encoded, size);
+    self->head += size;
+    self->count++;
+    self->sinceKeyframe = keyframe ? 0 : self->sinceKeyframe + 1;
+    SDL_memcpy(self->prev, play, sizeof(PlayState));
+
+    self->recordNs += (SDL_GetPerformanceCounter() - start) * 1000000000 / SDL_GetPerformanceFrequency();
+    self->recorded++;
+}
+
+// Rebuilds an earlier tick from its keyframe and the deltas after it. Ticks
+// after it are dropped, play resumes from there.
+bool history_restore(History* self, uint32 tick, PlayState* out) {
+    if (self->count == 0 || tick < self->firstTick || tick - self->firstTick >= self->count) {
+        return false;
+    }
+    uint32 index = tick - self->firstTick;
+    uint32 from = index;
+    while (!self->ticks[(self->first + from) % self->tickCapacity].keyframe) {
+        --from;
+    }
+
+    SDL_memset(self->prev, 0, sizeof(PlayState));
+    for (uint32 i = from; i <= index; ++i) {
+        HistoryTick* entry = &self->ticks[(self->first + i) % self->tickCapacity];
+        if (!xor_rle_decode(self->data + entry->offset, entry->size, (uint8*)self->prev, sizeof(PlayState))) {
+            SDL_Log("history: tick %u does not decode", self->firstTick + i);
+            self->count = 0;
+            return false;
+        }
+    }
+
+    SDL_memcpy(out, self->prev, sizeof(PlayState));
+    HistoryTick* last = &self->ticks[(self->first + index) % self->tickCapacity];
+    self->head = last->offset + last->size;
+    self->count = index + 1;
+    self->sinceKeyframe = index - from;
+    return true;
+}
+
+void histogram_add(Histogram* self, uint32 value) {
+    int index = (int)value;
+    if (value >= (1u << HISTOGRAM_SUB_BITS)) {
+        int shift = bit_highest(value) - HISTOGRAM_SUB_BITS;
+        index = ((shift + 1) << HISTOGRAM_SUB_BITS) + (int)((value >> shift) & ((1u << HISTOGRAM_SUB_BITS) - 1));
+    }
+    self->counts[index]++;
+    self->total++;
+    self->max = SDL_max(self->max, value);
+}
+
+// The upper edge of the bucket holding that percentile, never above the max
+uint32 histogram_percentile(Histogram* self, float64 percentile) {
+    if (self->total == 0) {
+        return 0;
+    }
+    uint64 rank = (uint64)(percentile / 100.0 * self->total + 0.5);
+    rank = SDL_max(rank, 1);
+    uint64 seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        seen += self->counts[i];
+        if (seen >= rank) {
+            if (i < (1 << HISTOGRAM_SUB_BITS)) {
+                return (uint32)i;
+            }
+            int shift = (i >> HISTOGRAM_SUB_BITS) - 1;
+            uint64 upper = ((uint64)((1 << HISTOGRAM_SUB_BITS) + (i & ((1 << HISTOGRAM_SUB_BITS) - 1))) << shift) + ((1ull << shift) - 1);
+            return (uint32)SDL_min(upper, self->max);
+        }
+    }
+    return self->max;
+}
+
+void frame_stats_add(FrameStats* self, const uint64* stageNs) {
+    for (int i = 0; i < FrameStage_Count; ++i) {
+        self->last[i] = (uint32)SDL_min(stageNs[i] / 1000, 0xffffffffu);
+        histogram_add(&self->stages[i], self->last[i]);
+    }
+}
+
+void frame_stats_report(FrameStats* self) {
+    static const char* cStageNames[FrameStage_Count] = { "frame", "update", "render", "present" };
+    for (int i = 0; i < FrameStage_Count; ++i) {
+        Histogram* h = &self->stages[i];
+        SDL_Log("frames: %-7s p50 %7.2fms  p99 %7.2fms  p99.9 %7.2fms  max %7.2fms  (%llu frames)", cStageNames[i],
+            histogram_percentile(h, 50) / 1000.0, histogram_percentile(h, 99) / 1000.0,
+            histogram_percentile(h, 99.9) / 1000.0, h->max / 1000.0, (unsigned long long)h->total);
+    }
+    if (self->hitchUs > 0) {
+        SDL_Log("frames: %u hitches over %.1fms", self->hitches, self->hitchUs / 1000.0);
+    }
+}
+
+HitchRecorder* hitch_recorder_start(const char* directory, uint32 seed, uint32 tick) {
+    HitchRecorder* self = (HitchRecorder*)calloc(1, sizeof(HitchRecorder));
+    if (!self) {
+        return NULL;
+    }
+    self->seed = seed;
+    self->nextTick = tick;
+    self->directory = directory;
+    self->ready = SDL_CreateSemaphore(0);
+    SDL_AtomicSet(&self->pending, 0);
+    SDL_AtomicSet(&self->running, 1);
+    self->thread = SDL_CreateThread(hitch_writer, "hitch", self);
+    return self;
+}
+
+// Finishes a save still being written before returning
+void hitch_recorder_stop(HitchRecorder* self) {
+    SDL_AtomicSet(&self->running, 0);
+    SDL_SemPost(self->ready);
+    SDL_WaitThread(self->thread, NULL);
+    SDL_DestroySemaphore(self->ready);
+    free(self);
+}
+
+// Called with the state a tick starts from and the input it is about to run
+// with, before any debug kill is applied
+void hitch_recorder_tick(HitchRecorder* self, PlayState* play, Config* config, uint8 buttons, int kill) {
+    if (play->tick != self->nextTick) {
+        self->snapshotCount = 0;
+        self->saveTick = 0;
+    }
+    self->nextTick = play->tick + 1;
+
+    // hold on to the older snapshot while a hitch waits to be saved
+    if (self->saveTick == 0 && play->tick % HITCH_SNAPSHOT_TICKS == 0) {
+        if (self->snapshotCount == 2) {
+            self->snapshots[0] = self->snapshots[1];
+            self->snapshotButtons[0] = self->snapshotButtons[1];
+        }
+        else {
+            self->snapshotCount++;
+        }
+        self->snapshots[self->snapshotCount - 1] = *play;
+        self->snapshotButtons[self->snapshotCount - 1] = self->buttons[(play->tick + HITCH_MAX_TICKS - 1) % HITCH_MAX_TICKS];
+    }
+    self->buttons[play->tick % HITCH_MAX_TICKS] = buttons;
+    self->kills[play->tick % HITCH_MAX_TICKS] = (int16)kill;
+
+    if (self->saveTick != 0 && play->tick + 1 >= self->saveTick) {
+        hitch_recorder_save(self, config);
+    }
+}
+
+void hitch_recorder_trigger(HitchRecorder* self, uint32 tick) {
+    if (self->saveTick == 0 && self->snapshotCount > 0 && self->saved < MAX_HITCH_FILES) {
+        self->hitchTick = tick;
+        self->saveTick = tick + HITCH_AFTER_TICKS;
+    }
+}
+
+// Hands the older snapshot and every input since to the writer thread
+void hitch_recorder_save(HitchRecorder* self, Config* config) {
+    self->saveTick = 0;
+    if (SDL_AtomicGet(&self->pending)) {
+        SDL_Log("hitch: still writing the last one, dropped the hitch before tick %u", self->hitchTick);
+        return;
+    }
+
+    HitchSave* save = &self->save;
+    save->config = *config;
+    save->start = self->snapshots[0];
+    save->startButtons = self->snapshotButtons[0];
+    save->hitchTick = self->hitchTick;
+    save->tickCount = self->nextTick - save->start.tick;
+    for (uint32 i = 0; i < save->tickCount; ++i) {
+        uint32 tick = save->start.tick + i;
+        save->buttons[i] = self->buttons[tick % HITCH_MAX_TICKS];
+        save->kills[i] = self->kills[tick % HITCH_MAX_TICKS];
+    }
+    self->saved++;
+
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&self->pending, 1);
+    SDL_SemPost(self->ready);
+}
+
+int hitch_writer(void* data) {
+    HitchRecorder* self = (HitchRecorder*)data;
+    for (;;) {
+        SDL_SemWait(self->ready);
+        if (!SDL_AtomicGet(&self->pending)) {
+            if (!SDL_AtomicGet(&self->running)) {
+                break;
+            }
+            continue;
+        }
+        SDL_MemoryBarrierAcquire();
+
+        HitchSave* save = &self->save;
+        char path[1024];
+        SDL_snprintf(path, sizeof(path), "%s/hitch-%u.vrec", self->directory, save->hitchTick);
+        Recording* recording = recording_create(path, self->seed, &save->config, &save->start, save->startButtons);
+        if (recording) {
+            for (uint32 i = 0; i < save->tickCount; ++i) {
+                recording_write(recording, save->buttons[i], save->kills[i]);
+            }
+            SDL_Log("hitch: saved ticks %u to %u as %s, reproduce with --replay %s",
+                save->start.tick, save->start.tick + save->tickCount - 1, path, path);
+            recording_close(recording);
+        }
+        SDL_AtomicSet(&self->pending, 0);
+    }
+    return 0;
+}
+
+void frame_scheduler_init(FrameScheduler* self, uint64 budgetNs) {
+    SDL_memset(self, 0, sizeof(*self));
+    self->budgetNs = budgetNs;
+    self->admitted = (1u << FrameTask_Count) - 1;
+    self->detail = 1.f;
+}
+
+// Called once the frame's ticks have run. Admits the wanted tasks that fit
+// in what is left after the time already spent and the usual core drawing.
+void frame_scheduler_plan(FrameScheduler* self, uint64 frameStart, uint32 wanted) {
+    self->optionalNs = 0;
+    if (self->budgetNs == 0) {
+        self->admitted = (1u << FrameTask_Count) - 1;
+        return;
+    }
+    uint64 spentNs = (SDL_GetPerformanceCounter() - frameStart) * 1000000000 / SDL_GetPerformanceFrequency();
+    int64 left = (int64)self->budgetNs - (int64)spentNs - (int64)self->coreNs;
+    bool deferred = false;
+    self->admitted = 0;
+    for (int i = 0; i < FrameTask_Count; ++i) {
+        FrameTaskCost* task = &self->tasks[i];
+        if (!(wanted & 1u << i)) {
+            continue;
+        }
+        // nothing waits forever, a starved task runs and the frame runs long
+        if ((int64)task->estimateNs <= left || task->deferred >= FRAME_TASK_MAX_DEFER) {
+            self->admitted |= 1u << i;
+            left -= (int64)task->estimateNs;
+        }
+        else {
+            task->deferred++;
+            task->skips++;
+            deferred = true;
+        }
+    }
+
+    // back off quickly, come back slowly once there is room to spare
+    if (deferred) {
+        self->detail = SDL_max(self->detail * 0.75f, FRAME_MIN_DETAIL);
+    }
+    else if (left > (int64)self->budgetNs / 4) {
+        self->detail = SDL_min(self->detail + 0.01f, 1.f);
+    }
+}
+
+bool frame_scheduler_begin(FrameScheduler* self, FrameTask task) {
+    if (!(self->admitted & 1u << task)) {
+        return false;
+    }
+    self->tasks[task].start = SDL_GetPerformanceCounter();
+    return true;
+}
+
+void frame_scheduler_end(FrameScheduler* self, FrameTask task) {
+    FrameTaskCost* cost = &self->tasks[task];
+    uint64 ns = (SDL_GetPerformanceCounter() - cost->start) * 1000000000 / SDL_GetPerformanceFrequency();
+    cost->estimateNs = cost->runs == 0 ? ns : cost->estimateNs + ((int64)ns - (int64)cost->estimateNs) / 8;
+    cost->deferred = 0;
+    cost->runs++;
+    self->optionalNs += ns;
+}
+
+void frame_scheduler_core(FrameScheduler* self, uint64 ns) {
+    self->coreNs = self->coreNs == 0 ? ns : self->coreNs + ((int64)ns - (int64)self->coreNs) / 8;
+}
+
+void frame_scheduler_report(FrameScheduler* self) {
+    static const char* cTaskNames[FrameTask_Count] = { "shields", "particle-draw", "capture", "particles", "hud" };
+    if (self->budgetNs == 0) {
+        return;
+    }
+    SDL_Log("budget: %.2fms a frame, core drawing %.2fms, particle detail %d%%", self->budgetNs / 1e6,
+        self->coreNs / 1e6, (int)(self->detail * 100.f + 0.5f));
+    for (int i = 0; i < FrameTask_Count; ++i) {
+        FrameTaskCost* task = &self->tasks[i];
+        if (task->runs + task->skips > 0) {
+            SDL_Log("budget: %-13s %7.3fms  ran %u  deferred %u", cTaskNames[i], task->estimateNs / 1e6, task->runs,
+                task->skips);
+        }
+    }
+}
+
+// Renders every tick of a recording to PREFIX000000.bmp onwards, --jobs wide
+int replay_render_run(Options* options) {
+    ReplayRender render;
+    SDL_memset(&render, 0, sizeof(render));
+    render.outputPrefix = options->renderOutputPrefix;
+    configure(&render.config);
+    Recording* recording = recording_open(options->renderInputPath, &render.seed, &render.config);
+    if (!recording) {
+        return 1;
+    }
+
+    // inputs in memory so any segment can start anywhere
+    uint32 capacity = 60 * 60 * SIM_TICK_RATE;
+    render.buttons = (uint8*)malloc(capacity);
+    render.kills = (int16*)malloc(capacity * sizeof(int16));
+    uint8 buttons;
+    int kill;
+    while (recording_read(recording, &buttons, &kill)) {
+        if (render.tickCount == capacity) {
+            capacity *= 2;
+            render.buttons = (uint8*)realloc(render.buttons, capacity);
+            render.kills = (int16*)realloc(render.kills, capacity * sizeof(int16));
+        }
+        render.buttons[render.tickCount] = buttons;
+        render.kills[render.tickCount] = (int16)kill;
+        render.tickCount++;
+    }
+
+    // the serial pass, sets up the session the same way --replay does
+    Session* session = (Session*)calloc(1, sizeof(Session));
+    session_init(session, render.seed);
+    session->config = render.config;
+    GameState* state = &session->state;
+    if (recording->start) {
+        state->play = *recording->start;
+        input_apply_tick_buttons(&state->input, &state->remoteButtons, recording->startButtons);
+        input_update(&state->input);
+    }
+    else if (render.config.stress) {
+        play_reset(&state->play, &session->config);
+    }
+    recording_close(recording);
+
+    uint64 start = SDL_GetPerformanceCounter();
+    render.segmentCount = (int)((render.tickCount + RENDER_SEGMENT_TICKS - 1) / RENDER_SEGMENT_TICKS);
+    render.keyframes = (GameState*)malloc(SDL_max(render.segmentCount, 1) * sizeof(GameState));
+    render.endHashes = (uint64*)malloc(SDL_max(render.segmentCount, 1) * sizeof(uint64));
+    for (uint32 tick = 0; tick < render.tickCount; ++tick) {
+        if (tick % RENDER_SEGMENT_TICKS == 0) {
+            render.keyframes[tick / RENDER_SEGMENT_TICKS] = *state;
+        }
+        replay_render_step(&render, session, tick);
+        if ((tick + 1) % RENDER_SEGMENT_TICKS == 0 || tick + 1 == render.tickCount) {
+            render.endHashes[tick / RENDER_SEGMENT_TICKS] = play_hash(&state->play);
+        }
+    }
+    uint64 split = SDL_GetPerformanceCounter();
+
+    // --jobs counts this thread too, 1 renders everything serially
+    int jobThreads = options->jobThreads > 0 ? options->jobThreads : SDL_GetCPUCount();
+    JobSystem* jobs = job_system_create(jobThreads - 1);
+    SDL_AtomicSet(&render.frames, 0);
+    SDL_AtomicSet(&render.mismatched, 0);
+    job_parallel_for(jobs, render.segmentCount, 1, replay_render_segments, &render);
+    if (jobs) {
+        job_system_destroy(jobs);
+    }
+
+    uint64 end = SDL_GetPerformanceCounter();
+    float64 frequency = (float64)SDL_GetPerformanceFrequency();
+    int frames = SDL_AtomicGet(&render.frames);
+    SDL_Log("render: %d frames in %d segments on %d threads, split %.2fs, render %.2fs (%.0f frames/s)",
+        frames, render.segmentCount, jobThreads, (split - start) / frequency, (end - split) / frequency,
+        frames / SDL_max((end - split) / frequency, 1e-9));
+    int mismatched = SDL_AtomicGet(&render.mismatched);
+    if (mismatched > 0) {
+        SDL_Log("render: %d segments did not end where the serial pass did", mismatched);
+    }
+
+    session_free(session);
+    free(session);
+    free(render.keyframes);
+    free(render.endHashes);
+    free(render.buttons);
+    free(render.kills);
+    return mismatched > 0 ? 1 : 0;
+}
+
+// One tick of the recording, as --replay runs it
+void replay_render_step(ReplayRender* self, Session* session, uint32 tick) {
+    GameState* state = &session->state;
+    input_apply_tick_buttons(&state->input, &state->remoteButtons, self->buttons[tick]);
+    if (self->kills[tick] >= 0) {
+        invader_kill(&state->play, &session->config, self->kills[tick]);
+    }
+    session_update(session, SIM_TICK_DT);
+    input_update(&state->input);
+}
+
+// Job over segments. Each gets its own session from the segment's keyframe
+// and its own framebuffer, nothing is shared but the inputs.
+void replay_render_segments(void* data, int begin, int end) {
+    ReplayRender* self = (ReplayRender*)data;
+    Session* session = (Session*)calloc(1, sizeof(Session));
+    uint8* pixels = (uint8*)malloc(SCREEN_PIXELS);
+    SDL_Color colors[3] = { cCaptureBackground, cColorPalette[0], cColorPalette[1] };
+    SDL_Surface* surface = frame_surface_create(colors, 3);
+
+    for (int segment = begin; segment < end; ++segment) {
+        session_init(session, self->seed);
+        session->config = self->config;
+        session->state = self->keyframes[segment];
+
+        uint32 first = (uint32)segment * RENDER_SEGMENT_TICKS;
+        uint32 last = SDL_min(first + RENDER_SEGMENT_TICKS, self->tickCount);
+        for (uint32 tick = first; tick < last; ++tick) {
+            replay_render_step(self, session, tick);
+            frame_rasterize(&session->state, pixels);
+            char name[1024];
+            snprintf(name, sizeof(name), "%s%06u.bmp", self->outputPrefix, tick);
+            frame_save(surface, pixels, name);
+        }
+        if (play_hash(&session->state.play) != self->endHashes[segment]) {
+            SDL_AtomicAdd(&self->mismatched, 1);
+        }
+        SDL_AtomicAdd(&self->frames, (int)(last - first));
+    }
+
+    SDL_FreeSurface(surface);
+    free(pixels);
+    session_free(session);
+    free(session);
+}
+
+bool net_startup(void) {
+#ifdef _WIN32
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+        SDL_Log("net: WSAStartup failed");
+        return false;
+    }
+#endif
+    return true;
+}
+
+void net_shutdown(void) {
+#ifdef _WIN32
+    WSACleanup();
+#endif
+}
+
+void net_socket_close(NetSocket socket) {
+#ifdef _WIN32
+    closesocket(socket);
+#else
+    close(socket);
+#endif
+}
+
+// Parses "host" or "host:port" into an IPv4 address
+bool net_resolve(const char* address, uint16 defaultPort, struct sockaddr_in* out) {
+    char host[256];
+    uint16 port = defaultPort;
+    SDL_strlcpy(host, address, sizeof(host));
+    char* colon = SDL_strchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        port = (uint16)SDL_atoi(colon + 1);
+    }
+
+    struct addrinfo hints;
+    struct addrinfo* result = NULL;
+    SDL_memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, NULL, &hints, &result) != 0 || !result) {
+        SDL_Log("net: could not resolve %s", host);
+        return false;
+    }
+    SDL_memcpy(out, result->ai_addr, sizeof(*out));
+    out->sin_port = htons(port);
+    freeaddrinfo(result);
+    return true;
+}
+
+bool net_link_open(NetLink* self, uint16 port, Options* options) {
+    SDL_memset(self, 0, sizeof(*self));
+    self->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (self->socket == NET_INVALID_SOCKET) {
+        SDL_Log("net: socket failed");
+        return false;
+    }
+
+    struct sockaddr_in local;
+    SDL_memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(port);
+    if (bind(self->socket, (struct sockaddr*)&local, sizeof(local)) != 0) {
+        SDL_Log("net: could not bind port %u", port);
+        net_socket_close(self->socket);
+        return false;
+    }
+
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    ioctlsocket(self->socket, FIONBIO, &nonBlocking);
+#else
+    fcntl(self->socket, F_SETFL, fcntl(self->socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+    self->latencyMs = options->netLatencyMs;
+    self->jitterMs = options->netJitterMs;
+    self->lossPercent = options->netLossPercent;
+    rng_seed(&self->rng, options->seed ^ port ^ 0x1e7u);
+    if (self->latencyMs || self->jitterMs || self->lossPercent) {
+        self->queue = (NetPacket*)malloc(NET_SHIM_QUEUE * sizeof(NetPacket));
+    }
+    return true;
+}
+
+void net_link_close(NetLink* self) {
+    if (self->socket != NET_INVALID_SOCKET) {
+        net_socket_close(self->socket);
+        self->socket = NET_INVALID_SOCKET;
+    }
+    free(self->queue);
+    self->queue = NULL;
+}
+
+void net_link_send(NetLink* self, const struct sockaddr_in* to, const uint8* data, int size, uint64 nowMs) {
+    self->bytesSent += size;
+    self->packetsSent++;
+
+    if (!self->queue) {
+        sendto(self->socket, (const char*)data, size, 0, (const struct sockaddr*)to, sizeof(*to));
+        return;
+    }
+
+    if (rng_next(&self->rng) % 100 < self->lossPercent || self->queued == NET_SHIM_QUEUE) {
+        self->packetsDropped++;
+        return;
+    }
+    NetPacket* packet = &self->queue[self->queued++];
+    uint32 jitter = self->jitterMs ? rng_next(&self->rng) % (self->jitterMs + 1) : 0;
+    packet->releaseMs = nowMs + self->latencyMs + jitter;
+    packet->to = *to;
+    packet->size = size;
+    SDL_memcpy(packet->data, data, size);
+}
+
+// Puts every shimmed packet whose delay has passed on the wire. Jitter can
+// reorder them, same as a real network.
+void net_link_pump(NetLink* self, uint64 nowMs) {
+    int i = 0;
+    while (i < self->queued) {
+        NetPacket* packet = &self->queue[i];
+        if (packet->releaseMs > nowMs) {
+            ++i;
+            continue;
+        }
+        sendto(self->socket, (const char*)packet->data, packet->size, 0,
+            (const struct sockaddr*)&packet->to, sizeof(packet->to));
+        *packet = self->queue[--self->queued];
+    }
+}
+
+int net_link_receive(NetLink* self, struct sockaddr_in* from, uint8* data, int capacity) {
+    socklen_t fromSize = sizeof(*from);
+    int size = (int)recvfrom(self->socket, (char*)data, capacity, 0, (struct sockaddr*)from, &fromSize);
+    return size;
+}
+
+void net_snapshot_capture(NetSnapshot* self, PlayState* play, Config* config) {
+    SDL_memset(self, 0, sizeof(*self));
+    self->tick = play->tick;
+    self->score = play->score;
+    self->lives = (uint8)SDL_max(play->lives, 0);
+    self->wave = (uint8)play->wave;
+    self->tankMode = (uint8)play->tank.mode;
+    self->aimColumn = (uint8)play->aimColumn;
+    self->tankX = (uint16)(play->tank.target.position.x >> (FX_SHIFT - 2));
+
+    for (int row = 0; row < INVADER_ROWS; ++row) {
+        self->rowTypes |= (uint16)(play->invaders[row * INVADER_COLS].invaderType << (row * 2));
+    }
+    int pitchX, pitchY;
+    invader_grid_pitch(wave_layout(config, play->wave), &pitchX, &pitchY);
+    self->gridPitchX = (uint8)pitchX;
+    self->gridPitchY = (uint8)pitchY;
+
+    bool haveSwarm = false;
+    int divers = 0;
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        InvaderState* invader = &play->invaders[i];
+        if (!invader->active) {
+            continue;
+        }
+        self->invaderActive[i / 8] |= 1 << (i % 8);
+        if (invader->diving && divers < MAX_DIVERS) {
+            self->diverIndex[divers] = (uint8)(i + 1);
+            self->diverX[divers] = (int8)SDL_max(-127, SDL_min(fx_to_int(invader->diveOffset.x), 127));
+            self->diverY[divers] = (uint8)SDL_max(0, SDL_min(fx_to_int(invader->diveOffset.y), 255));
+            ++divers;
+        }
+        if (!haveSwarm) {
+            int x = i % INVADER_COLS * pitchX;
+            int y = i / INVADER_COLS * pitchY;
+            self->swarmX = (int16)((invader->target.position.x - fx_from_int(x)) >> (FX_SHIFT - 2));
+            self->swarmY = (int16)((invader->target.position.y - fx_from_int(y)) >> (FX_SHIFT - 2));
+            self->invaderFrame = (uint8)(invader->frame & 0x1);
+            haveSwarm = true;
+        }
+    }
+
+    for (int i = 0; i < MAX_BULLETS; ++i) {
+        BulletState* bullet = &play->bullets[i];
+        if (!bullet->active) {
+            continue;
+        }
+        self->bulletActive |= 1u << i;
+        self->bulletX[i] = (uint8)SDL_max(0, SDL_min(fx_to_int(bullet->target.position.x), 255));
+        self->bulletY[i] = (uint8)SDL_max(0, SDL_min(fx_to_int(bullet->target.position.y), 255));
+        int anim = (bullet->frame / 30) % bullet->frameCount;
+        self->bulletInfo[i] = (uint8)((bullet->direction > 0 ? 0x1 : 0) | anim << 1);
+    }
+
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        mask_pack_bits(play->shields[i].pixels, SHIELD_WIDTH * SHIELD_HEIGHT, self->shields[i]);
+    }
+
+    UfoState* ufo = &play->ufo;
+    self->ufoX = (int16)fx_to_int(ufo->target.position.x);
+    self->ufoMode = ufo->active ? 1 : (ufo->deathTime > 0) ? 2 : 0;
+}
+
+// One bit per nonzero byte, bit j % 8 of bits[j / 8]. bits must start zeroed.
+void mask_pack_bits(const uint8* values, int count, uint8* bits) {
+    int j = 0;
+#ifdef VASION_SSE2
+    // movemask hands back 16 pixels' bits already in this order
+    __m128i zero = _mm_setzero_si128();
+    for (; j + 16 <= count; j += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(values + j));
+        int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & 0xffff;
+        bits[j / 8] = (uint8)mask;
+        bits[j / 8 + 1] = (uint8)(mask >> 8);
+    }
+#endif
+    for (; j < count; ++j) {
+        bits[j / 8] |= (uint8)((values[j] != 0) << (j % 8));
+    }
+}
+
+// Little endian, field by field, zero padded to NET_SNAPSHOT_BYTES
+void net_snapshot_pack(const NetSnapshot* self, uint8* out) {
+    uint8* p = out;
+    SDL_memset(out, 0, NET_SNAPSHOT_BYTES);
+    put_u32(p, self->tick); p += 4;
+    put_u32(p, self->score); p += 4;
+    *p++ = self->lives;
+    *p++ = self->wave;
+    *p++ = self->tankMode;
+    *p++ = self->aimColumn;
+    put_u16(p, self->tankX); p += 2;
+    put_u16(p, (uint16)self->swarmX); p += 2;
+    put_u16(p, (uint16)self->swarmY); p += 2;
+    *p++ = self->gridPitchX;
+    *p++ = self->gridPitchY;
+    *p++ = self->invaderFrame;
+    SDL_memcpy(p, self->invaderActive, sizeof(self->invaderActive)); p += sizeof(self->invaderActive);
+    put_u32(p, self->bulletActive); p += 4;
+    SDL_memcpy(p, self->bulletX, MAX_BULLETS); p += MAX_BULLETS;
+    SDL_memcpy(p, self->bulletY, MAX_BULLETS); p += MAX_BULLETS;
+    SDL_memcpy(p, self->bulletInfo, MAX_BULLETS); p += MAX_BULLETS;
+    SDL_memcpy(p, self->shields, sizeof(self->shields)); p += sizeof(self->shields);
+    put_u16(p, (uint16)self->ufoX); p += 2;
+    *p++ = self->ufoMode;
+    put_u16(p, self->rowTypes); p += 2;
+    SDL_memcpy(p, self->diverIndex, MAX_DIVERS); p += MAX_DIVERS;
+    SDL_memcpy(p, self->diverX, MAX_DIVERS); p += MAX_DIVERS;
+    SDL_memcpy(p, self->diverY, MAX_DIVERS);
+}
+
+void net_snapshot_unpack(NetSnapshot* self, const uint8* in) {
+    const uint8* p = in;
+    self->tick = get_u32(p); p += 4;
+    self->score = get_u32(p); p += 4;
+    self->lives = *p++;
+    self->wave = *p++;
+    self->tankMode = *p++;
+    self->aimColumn = *p++;
+    self->tankX = get_u16(p); p += 2;
+    self->swarmX = (int16)get_u16(p); p += 2;
+    self->swarmY = (int16)get_u16(p); p += 2;
+    self->gridPitchX = *p++;
+    self->gridPitchY = *p++;
+    self->invaderFrame = *p++;
+    SDL_memcpy(self->invaderActive, p, sizeof(self->invaderActive)); p += sizeof(self->invaderActive);
+    self->bulletActive = get_u32(p); p += 4;
+    SDL_memcpy(self->bulletX, p, MAX_BULLETS); p += MAX_BULLETS;
+    SDL_memcpy(self->bulletY, p, MAX_BULLETS); p += MAX_BULLETS;
+    SDL_memcpy(self->bulletInfo, p, MAX_BULLETS); p += MAX_BULLETS;
+    SDL_memcpy(self->shields, p, sizeof(self->shields)); p += sizeof(self->shields);
+    self->ufoX = (int16)get_u16(p); p += 2;
+    self->ufoMode = *p++;
+    self->rowTypes = get_u16(p); p += 2;
+    SDL_memcpy(self->diverIndex, p, MAX_DIVERS); p += MAX_DIVERS;
+    SDL_memcpy(self->diverX, p, MAX_DIVERS); p += MAX_DIVERS;
+    SDL_memcpy(self->diverY, p, MAX_DIVERS);
+}
+
+// Blends the continuously moving parts, t in 1/256ths. Discrete things
+// (swarm steps, deaths, shields) come from a so they are never early.
+void net_snapshot_lerp(NetSnapshot* out, const NetSnapshot* a, const NetSnapshot* b, int32 t) {
+    *out = *a;
+    out->tankX = (uint16)(a->tankX + (((int32)b->tankX - a->tankX) * t) / 256);
+    for (int i = 0; i < MAX_BULLETS; ++i) {
+        uint32 bit = 1u << i;
+        if ((a->bulletActive & bit) && (b->bulletActive & bit) &&
+            a->bulletX[i] == b->bulletX[i] && (a->bulletInfo[i] & 0x1) == (b->bulletInfo[i] & 0x1)) {
+            out->bulletY[i] = (uint8)(a->bulletY[i] + (((int32)b->bulletY[i] - a->bulletY[i]) * t) / 256);
+        }
+    }
+    if (a->ufoMode == 1 && b->ufoMode == 1) {
+        out->ufoX = (int16)(a->ufoX + (((int32)b->ufoX - a->ufoX) * t) / 256);
+    }
+    for (int i = 0; i < MAX_DIVERS; ++i) {
+        if (a->diverIndex[i] && a->diverIndex[i] == b->diverIndex[i]) {
+            out->diverX[i] = (int8)(a->diverX[i] + (((int32)b->diverX[i] - a->diverX[i]) * t) / 256);
+            out->diverY[i] = (uint8)(a->diverY[i] + (((int32)b->diverY[i] - a->diverY[i]) * t) / 256);
+        }
+    }
+}
+
+// Rebuilds a renderable PlayState from a snapshot and pushes the events the
+// client can infer from the change, so effects and audio still fire
+void net_snapshot_apply(const NetSnapshot* self, PlayState* view, Config* config, fixed dt) {
+    view->events.count = 0;
+    view->events.mask = 0;
+    view->tick = self->tick;
+    view->score = self->score;
+    view->lives = self->lives;
+    view->wave = self->wave;
+    view->aimColumn = SDL_min(self->aimColumn, INVADER_COLS - 1);
+
+    TankState* tank = &view->tank;
+    tank->target.position.x = (fixed)self->tankX << (FX_SHIFT - 2);
+    if (tank->mode == TankMode_Active && self->tankMode == TankMode_Dead) {
+        event_push(&view->events, GameEvent_TankHit, tank->target.position, view->lives);
+    }
+    tank->mode = (TankMode)self->tankMode;
+
+    // the swarm flips animation frame on every step it marches
+    bool marched = false;
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        InvaderState* invader = &view->invaders[i];
+        bool active = (self->invaderActive[i / 8] >> (i % 8)) & 1;
+        int invaderType = (self->rowTypes >> (i / INVADER_COLS * 2)) & 0x3;
+        if (active) {
+            marched |= invader->active && (invader->frame & 0x1) != self->invaderFrame;
+            int x = i % INVADER_COLS * self->gridPitchX;
+            int y = i / INVADER_COLS * self->gridPitchY;
+            invader->active = true;
+            invader->deathTime = 0;
+            invader->diving = false;
+            invader->diveOffset.x = 0;
+            invader->diveOffset.y = 0;
+            invader->invaderType = SDL_min(invaderType, 2);
+            const Sprite* sprite = &cSprites[cInvaderTextureTable[invader->invaderType]];
+            invader->target.width = fx_from_int(sprite->width);
+            invader->target.height = fx_from_int(sprite->height);
+            invader->frame = self->invaderFrame;
+            invader->target.position.x = fx_from_int(x) + ((fixed)self->swarmX << (FX_SHIFT - 2));
+            invader->target.position.y = fx_from_int(y) + ((fixed)self->swarmY << (FX_SHIFT - 2));
+        }
+        else if (invader->active) {
+            // keeps its last position for the explosion
+            invader->target = invader_hit_rect(invader);
+            invader->diveOffset.x = 0;
+            invader->diveOffset.y = 0;
+            invader->diving = false;
+            invader->active = false;
+            invader->deathTime = config->invaderDeathTime;
+            event_push(&view->events, GameEvent_InvaderKilled, invader->target.position, i);
+        }
+        else if (invader->deathTime > 0) {
+            invader->deathTime -= dt;
+        }
+    }
+    view->diverCount = 0;
+    for (int i = 0; i < MAX_DIVERS; ++i) {
+        int index = self->diverIndex[i] - 1;
+        if (index >= 0 && index < MAX_INVADERS && view->invaders[index].active) {
+            InvaderState* invader = &view->invaders[index];
+            invader->diving = true;
+            invader->diveOffset.x = fx_from_int(self->diverX[i]);
+            invader->diveOffset.y = fx_from_int(self->diverY[i]);
+            view->diverCount++;
+        }
+    }
+    swarm_rebuild(&view->swarm, view->invaders);
+    if (marched) {
+        SwarmIndex* swarm = &view->swarm;
+        Point swarmCenter = {
+            (swarm->bounds.left + swarm->bounds.right) / 2,
+            (swarm->bounds.top + swarm->bounds.bottom) / 2,
+        };
+        event_push(&view->events, GameEvent_InvaderMarch, swarmCenter, ++view->moveIndex);
+    }
+
+    for (int i = 0; i < MAX_BULLETS; ++i) {
+        BulletState* bullet = &view->bullets[i];
+        if (self->bulletActive & (1u << i)) {
+            if (!bullet->active) {
+                GameEventType type = (self->bulletInfo[i] & 0x1) ? GameEvent_InvaderShot : GameEvent_TankShot;
+                Point position = { fx_from_int(self->bulletX[i]), fx_from_int(self->bulletY[i]) };
+                event_push(&view->events, type, position, 0);
+            }
+            bullet_create(bullet, self->bulletX[i], self->bulletY[i], self->bulletInfo[i] & 0x1, BULLET_OWNER_NONE, 0);
+            bullet->frame = ((self->bulletInfo[i] >> 1) & 0x1) * 30;
+        }
+        else {
+            bullet->active = false;
+        }
+    }
+
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        ShieldState* shield = &view->shields[i];
+        bool changed = false;
+        for (int j = 0; j < SHIELD_WIDTH * SHIELD_HEIGHT; ++j) {
+            uint8 value = ((self->shields[i][j / 8] >> (j % 8)) & 1) ? cShieldImageData[j] : 0;
+            if (shield->pixels[j] != value) {
+                shield->pixels[j] = value;
+                changed = true;
+            }
+        }
+        if (changed) {
+            sprite_mask_rows(shield->pixels, SHIELD_WIDTH, SHIELD_HEIGHT, shield->mask);
+            shield->version++;
+        }
+    }
+
+    UfoState* ufo = &view->ufo;
+    bool wasActive = ufo->active;
+    ufo->active = self->ufoMode == 1;
+    ufo->target.position.x = fx_from_int(self->ufoX);
+    if (!wasActive && ufo->active) {
+        event_push(&view->events, GameEvent_UfoEnter, ufo->target.position, 0);
+    }
+    else if (wasActive && !ufo->active) {
+        GameEventType type = (self->ufoMode == 2) ? GameEvent_UfoKilled : GameEvent_UfoLeave;
+        event_push(&view->events, type, ufo->target.position, 0);
+    }
+    ufo->deathTime = (self->ufoMode == 2) ? config->invaderDeathTime : 0;
+}
+
+bool net_server_start(NetServer* self, Options* options) {
+    SDL_memset(self, 0, sizeof(*self));
+    if (!net_link_open(&self->link, options->serverPort, options)) {
+        return false;
+    }
+    SDL_Log("net: serving on port %u", options->serverPort);
+    return true;
+}
+
+void net_server_stop(NetServer* self) {
+    net_link_close(&self->link);
+}
+
+void net_server_receive(NetServer* self, uint64 nowMs) {
+    uint8 data[NET_MAX_PACKET];
+    struct sockaddr_in from;
+    int size;
+    while ((size = net_link_receive(&self->link, &from, data, sizeof(data))) > 0) {
+        if (size < 6 || data[0] != NetPacket_Input) {
+            continue;
+        }
+
+        NetClientSlot* client = NULL;
+        NetClientSlot* open = NULL;
+        for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+            NetClientSlot* slot = &self->clients[i];
+            if (slot->active && slot->address.sin_addr.s_addr == from.sin_addr.s_addr &&
+                slot->address.sin_port == from.sin_port) {
+                client = slot;
+                break;
+            }
+            if (!slot->active && !open) {
+                open = slot;
+            }
+        }
+        if (!client) {
+            if (!open) {
+                continue;
+            }
+            client = open;
+            SDL_memset(client, 0, sizeof(*client));
+            client->active = true;
+            client->address = from;
+            SDL_Log("net: client %d connected", (int)(client - self->clients));
+        }
+
+        // acks only move forward, late packets can't drag the baseline back
+        uint32 ack = get_u32(data + 1);
+        if (ack > client->ack) {
+            client->ack = ack;
+        }
+        client->buttons = data[5];
+        client->lastHeardMs = nowMs;
+    }
+
+    for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+        NetClientSlot* client = &self->clients[i];
+        if (client->active && nowMs - client->lastHeardMs > NET_CLIENT_TIMEOUT_MS) {
+            client->active = false;
+            SDL_Log("net: client %d timed out", i);
+        }
+    }
+}
+
+uint8 net_server_player_buttons(NetServer* self) {
+    return self->clients[0].active ? self->clients[0].buttons : 0;
+}
+
+// Snapshots the tick and sends it to every client as a delta against the
+// newest snapshot that client acknowledged, or whole when that is too old
+void net_server_send(NetServer* self, PlayState* play, Config* config, uint64 nowMs) {
+    if (play->tick % NET_SEND_INTERVAL != 0) {
+        return;
+    }
+
+    NetSnapshot snapshot;
+    net_snapshot_capture(&snapshot, play, config);
+    uint32 tick = snapshot.tick;
+    uint8* current = self->history[tick & (NET_HISTORY - 1)];
+    net_snapshot_pack(&snapshot, current);
+    self->historyTick[tick & (NET_HISTORY - 1)] = tick;
+
+    for (int i = 0; i < NET_MAX_CLIENTS; ++i) {
+        NetClientSlot* client = &self->clients[i];
+        if (!client->active) {
+            continue;
+        }
+
+        uint32 base = client->ack;
+        const uint8* baseline = NULL;
+        if (base != 0 && base < tick && tick - base < NET_HISTORY &&
+            self->historyTick[base & (NET_HISTORY - 1)] == base) {
+            baseline = self->history[base & (NET_HISTORY - 1)];
+        }
+        else {
+            base = 0;
+            client->keyframes++;
+        }
+
+        // [type][tick][ticks back to the baseline, 0 for a keyframe][delta]
+        uint8 packet[NET_MAX_PACKET];
+        packet[0] = NetPacket_Snapshot;
+        put_u32(packet + 1, tick);
+        packet[5] = (uint8)(base ? tick - base : 0);
+        int size = 6 + xor_rle_encode(current, baseline, NET_SNAPSHOT_BYTES, packet + 6);
+        net_link_send(&self->link, &client->address, packet, size, nowMs);
+        client->bytesSent += size;
+    }
+}
+
+bool net_client_start(NetClient* self, Options* options) {
+    SDL_memset(self, 0, sizeof(*self));
+    if (!net_resolve(options->connectAddress, NET_DEFAULT_PORT, &self->server)) {
+        return false;
+    }
+    return net_link_open(&self->link, 0, options);
+}
+
+void net_client_stop(NetClient* self) {
+    net_link_close(&self->link);
+}
+
+// Decodes every waiting snapshot whose baseline we still hold and returns
+// how many were stored
+// Stores every snapshot that arrived and returns how many. The first capacity
+// of their ticks also go in decoded, in the order they arrived, when it's set.
+int net_client_receive(NetClient* self, uint32* decoded, int capacity) {
+    uint8 data[NET_MAX_PACKET];
+    struct sockaddr_in from;
+    int size;
+    int stored = 0;
+    while ((size = net_link_receive(&self->link, &from, data, sizeof(data))) > 0) {
+        if (size < 6 || data[0] != NetPacket_Snapshot) {
+            continue;
+        }
+        uint32 tick = get_u32(data + 1);
+        uint32 base = data[5] ? tick - data[5] : 0;
+        if (tick == 0 || self->historyTick[tick & (NET_HISTORY - 1)] == tick) {
+            continue;
+        }
+        self->bytesReceived += size;
+
+        uint8 snapshot[NET_SNAPSHOT_BYTES];
+        if (base == 0) {
+            SDL_memset(snapshot, 0, sizeof(snapshot));
+        }
+        else if (self->historyTick[base & (NET_HISTORY - 1)] == base) {
+            SDL_memcpy(snapshot, self->history[base & (NET_HISTORY - 1)], sizeof(snapshot));
+        }
+        else {
+            continue;
+        }
+        if (!xor_rle_decode(data + 6, size - 6, snapshot, NET_SNAPSHOT_BYTES)) {
+            continue;
+        }
+
+        SDL_memcpy(self->history[tick & (NET_HISTORY - 1)], snapshot, sizeof(snapshot));
+        self->historyTick[tick & (NET_HISTORY - 1)] = tick;
+        if (tick > self->latestTick) {
+            self->latestTick = tick;
+        }
+        if (decoded && stored < capacity) {
+            decoded[stored] = tick;
+        }
+        ++stored;
+    }
+    return stored;
+}
+
+void net_client_send_input(NetClient* self, uint8 buttons, uint64 nowMs) {
+    uint8 packet[6];
+    packet[0] = NetPacket_Input;
+    put_u32(packet + 1, self->latestTick);
+    packet[5] = buttons;
+    net_link_send(&self->link, &self->server, packet, sizeof(packet), nowMs);
+}
+
+// Advances the client's render clock, which trails the newest snapshot by
+// NET_INTERP_TICKS, and interpolates the snapshots either side of it
+bool net_client_view(NetClient* self, float64 elapsedTicks, NetSnapshot* out) {
+    if (self->latestTick == 0) {
+        return false;
+    }
+
+    // ease toward the target delay rather than jumping, unless far off
+    float64 target = (float64)self->latestTick - NET_INTERP_TICKS;
+    self->renderTick += elapsedTicks;
+    float64 error = target - self->renderTick;
+    if (error > NET_HISTORY / 4 || error < -NET_HISTORY / 4) {
+        self->renderTick = target;
+    }
+    else {
+        self->renderTick += error * 0.05;
+    }
+    if (self->renderTick < 1) {
+        self->renderTick = 1;
+    }
+
+    uint32 floorTick = (uint32)self->renderTick;
+    uint32 a = 0, b = 0;
+    for (uint32 tick = floorTick; tick > 0 && floorTick - tick < NET_HISTORY; --tick) {
+        if (self->historyTick[tick & (NET_HISTORY - 1)] == tick) {
+            a = tick;
+            break;
+        }
+    }
+    for (uint32 tick = floorTick + 1; tick <= self->latestTick && tick - floorTick < NET_HISTORY; ++tick) {
+        if (self->historyTick[tick & (NET_HISTORY - 1)] == tick) {
+            b = tick;
+            break;
+        }
+    }
+
+    if (a == 0) {
+        a = b ? b : self->latestTick;
+        b = 0;
+    }
+    NetSnapshot snapshotA;
+    net_snapshot_unpack(&snapshotA, self->history[a & (NET_HISTORY - 1)]);
+    if (b == 0) {
+        *out = snapshotA;
+        return true;
+    }
+
+    NetSnapshot snapshotB;
+    net_snapshot_unpack(&snapshotB, self->history[b & (NET_HISTORY - 1)]);
+    int32 t = (int32)((self->renderTick - a) * 256.0 / (b - a));
+    net_snapshot_lerp(out, &snapshotA, &snapshotB, SDL_max(0, SDL_min(t, 256)));
+    return true;
+}
+
+// Player two: sends held buttons and acks, draws the interpolated view
+int net_client_run(Options* options, Display* display, Game* game, AudioState* audio) {
+    NetClient* client = (NetClient*)malloc(sizeof(NetClient));
+    if (!net_client_start(client, options)) {
+        free(client);
+        return 1;
+    }
+    SDL_Log("net: connecting to %s", options->connectAddress);
+
+    Session* view = game->session;
+    GameState* state = &view->state;
+    uint64 prevTicks = 0;
+    bool isRunning = true;
+    while (isRunning) {
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            switch (event.type) {
+                case SDL_QUIT:
+                    isRunning = false;
+                    break;
+
+                case SDL_KEYDOWN:
+                    input_set_key(&state->input, event.key.keysym.scancode, true);
+                    if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
+                        isRunning = false;
+                    }
+                    if (event.key.keysym.scancode == SDL_SCANCODE_F4) {
+                        game->hud.showDebug = !game->hud.showDebug;
+                    }
+                    break;
+
+                case SDL_KEYUP:
+                    input_set_key(&state->input, event.key.keysym.scancode, false);
+                    break;
+            }
+        }
+
+        uint64 ticks = SDL_GetPerformanceCounter();
+        uint64 diff = prevTicks ? (ticks - prevTicks) * 1000000000 / SDL_GetPerformanceFrequency() : 0;
+        prevTicks = ticks;
+        uint64 nowMs = SDL_GetTicks();
+
+        uint8 buttons = 0;
+        buttons |= input_get_key(&state->input, KEY_LEFT) ? VERSUS_BUTTON_LEFT : 0;
+        buttons |= input_get_key(&state->input, KEY_RIGHT) ? VERSUS_BUTTON_RIGHT : 0;
+        buttons |= input_get_key(&state->input, KEY_FIRE) ? VERSUS_BUTTON_FIRE : 0;
+
+        net_client_receive(client, NULL, 0);
+        net_client_send_input(client, buttons, nowMs);
+        net_link_pump(&client->link, nowMs);
+
+        NetSnapshot snapshot;
+        if (net_client_view(client, diff * (float64)SIM_TICK_RATE / 1e9, &snapshot)) {
+            net_snapshot_apply(&snapshot, &state->play, &view->config, (fixed)(diff * FX_ONE / 1000000000));
+            audio_post_events(audio, &state->play.events);
+            particles_post_events(game->particles, &state->play.events);
+        }
+        input_update(&state->input);
+
+        hud_frame_time(&game->hud, diff, game->particles->count);
+        game_update_particles(game, view->jobs, diff / 1e9f);
+
+        display_begin_frame(display);
+        game_render(game);
+        display_present(display);
+    }
+
+    SDL_Log("net: received %llu bytes", (unsigned long long)client->bytesReceived);
+    net_client_stop(client);
+    free(client);
+    return 0;
+}
+
+// Headless self test: a server and a client in one process talking over
+// localhost through the shim, on a virtual clock so it runs flat out. Every
+// snapshot the client decodes is checked against what the server sent.
+int net_loopback_run(Options* options) {
+    if (!net_startup()) {
+        return 1;
+    }
+
+    Options serverOptions = *options;
+    if (serverOptions.serverPort == 0) {
+        serverOptions.serverPort = NET_DEFAULT_PORT;
+    }
+    char address[32];
+    SDL_snprintf(address, sizeof(address), "127.0.0.1:%u", serverOptions.serverPort);
+    Options clientOptions = serverOptions;
+    clientOptions.connectAddress = address;
+    clientOptions.seed = options->seed + 1;
+
+    NetServer* server = (NetServer*)malloc(sizeof(NetServer));
+    NetClient* client = (NetClient*)malloc(sizeof(NetClient));
+    SoakSession* host = (SoakSession*)calloc(1, sizeof(SoakSession));
+    Session* view = (Session*)calloc(1, sizeof(Session));
+    bool serving = net_server_start(server, &serverOptions);
+    bool connected = serving && net_client_start(client, &clientOptions);
+    bool ok = connected && net_loopback_play(server, client, host, view, options);
+
+    if (connected) {
+        net_client_stop(client);
+    }
+    if (serving) {
+        net_server_stop(server);
+    }
+    session_free(view);
+    session_free(&host->session);
+    free(view);
+    free(host);
+    free(client);
+    free(server);
+    net_shutdown();
+    return ok ? 0 : 1;
+}
+
+// The loopback test proper, on a started server and client
+bool net_loopback_play(NetServer* server, NetClient* client, SoakSession* host, Session* view, Options* options) {
+    soak_session_start(host, options->seed | 1); // odd seeds play versus
+    host->remoteInput = true;
+    session_init(view, options->seed);
+    view->config.versus = true;
+
+    Rng player2;
+    rng_seed(&player2, options->seed ^ 0x2u);
+    uint8 buttons = 0;
+    uint32 ticks = (uint32)(options->netLoopbackSeconds * SIM_TICK_RATE);
+    uint32 decoded = 0, compared = 0, mismatched = 0;
+    const char* failure = NULL;
+
+    for (uint32 i = 0; i < ticks && !failure; ++i) {
+        uint64 nowMs = (uint64)i * 1000 / SIM_TICK_RATE;
+
+        net_server_receive(server, nowMs);
+        uint32 r = rng_next(&player2);
+        if ((r & 0x1f) == 0) {
+            buttons = (uint8)((r >> 8) & 0x7);
+        }
+        // player two plays through the network, the tick has to see it
+        host->session.state.remoteButtons = net_server_player_buttons(server);
+        failure = soak_session_step(host);
+        net_server_send(server, &host->session.state.play, &host->session.config, nowMs);
+        net_link_pump(&server->link, nowMs);
+
+        // every snapshot decoded has to match what the server sent for
+        // that tick, late and reordered ones included, while it still has it
+        uint32 ticksDecoded[NET_HISTORY];
+        int count = net_client_receive(client, ticksDecoded, NET_HISTORY);
+        decoded += count;
+        for (int j = 0; j < SDL_min(count, NET_HISTORY); ++j) {
+            uint32 tick = ticksDecoded[j];
+            int index = tick & (NET_HISTORY - 1);
+            if (server->historyTick[index] == tick && client->historyTick[index] == tick) {
+                ++compared;
+                mismatched += SDL_memcmp(server->history[index], client->history[index], NET_SNAPSHOT_BYTES) != 0;
+            }
+        }
+        NetSnapshot snapshot;
+        if (net_client_view(client, 1.0, &snapshot)) {
+            net_snapshot_apply(&snapshot, &view->state.play, &view->config, SIM_TICK_DT);
+        }
+        net_client_send_input(client, buttons, nowMs);
+        net_link_pump(&client->link, nowMs);
+    }
+
+    NetClientSlot* slot = &server->clients[0];
+    float64 seconds = (float64)ticks / SIM_TICK_RATE;
+    uint64 wireBytes = slot->bytesSent + (uint64)server->link.packetsSent * NET_UDP_OVERHEAD;
+    SDL_Log("net: %u ticks, %u snapshots decoded, %u compared, %u mismatched, %u keyframes, %u dropped by shim",
+        ticks, decoded, compared, mismatched, slot->keyframes, server->link.packetsDropped);
+    SDL_Log("net: %.1f bytes/snapshot payload, %.0f B/s to the client (%.0f B/s with UDP/IP headers)",
+        server->link.packetsSent ? (float64)slot->bytesSent / server->link.packetsSent : 0.0,
+        slot->bytesSent / seconds, wireBytes / seconds);
+    if (failure) {
+        SDL_Log("net: server invariant failed: %s", failure);
+    }
+
+    return !failure && mismatched == 0 && decoded > 0;
+}
+
+// Creates the named mapping when owner, otherwise attaches to it read only
+FeedState* feed_start(const char* name, bool owner) {
+    FeedState* self = (FeedState*)malloc(sizeof(FeedState));
+    SDL_memset(self, 0, sizeof(*self));
+    self->owner = owner;
+    SDL_strlcpy(self->name, name, sizeof(self->name));
+
+#ifdef _WIN32
+    // the Windows object namespace has no leading slash
+    const char* objectName = (name[0] == '/') ? name + 1 : name;
+    if (owner) {
+        self->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(FeedHeader), objectName);
+    }
+    else {
+        self->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, objectName);
+    }
+    if (self->mapping) {
+        self->header = (FeedHeader*)MapViewOfFile(self->mapping, owner ? FILE_MAP_ALL_ACCESS : FILE_MAP_READ, 0, 0, sizeof(FeedHeader));
+    }
+#else
+    int fd = owner ? shm_open(name, O_CREAT | O_RDWR, 0644) : shm_open(name, O_RDONLY, 0);
+    if (fd >= 0) {
+        if (!owner || ftruncate(fd, sizeof(FeedHeader)) == 0) {
+            void* memory = mmap(NULL, sizeof(FeedHeader), owner ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+            self->header = (memory == MAP_FAILED) ? NULL : (FeedHeader*)memory;
+        }
+        // the mapping keeps the object alive
+        close(fd);
+    }
+#endif
+
+    if (!self->header) {
+        SDL_Log("feed: could not %s shared memory %s", owner ? "create" : "open", name);
+        feed_stop(self);
+        return NULL;
+    }
+
+    if (owner) {
+        SDL_memset(self->header, 0, sizeof(FeedHeader));
+        self->header->version = FEED_VERSION;
+        self->header->slotCount = FEED_SLOTS;
+        self->header->slotBytes = NET_SNAPSHOT_BYTES;
+        // readers check magic last, so they never see a half set up header
+        SDL_MemoryBarrierRelease();
+        self->header->magic = FEED_MAGIC;
+        SDL_Log("feed: publishing to %s", name);
+    }
+    else if (self->header->magic != FEED_MAGIC || self->header->version != FEED_VERSION ||
+        self->header->slotCount != FEED_SLOTS || self->header->slotBytes != NET_SNAPSHOT_BYTES) {
+        SDL_Log("feed: %s is not a version %d feed", name, FEED_VERSION);
+        feed_stop(self);
+        return NULL;
+    }
+    return self;
+}
+
+void feed_stop(FeedState* self) {
+#ifdef _WIN32
+    if (self->header) {
+        UnmapViewOfFile(self->header);
+    }
+    if (self->mapping) {
+        CloseHandle(self->mapping);
+    }
+#else
+    if (self->header) {
+        munmap(self->header, sizeof(FeedHeader));
+    }
+    if (self->owner) {
+        shm_unlink(self->name);
+    }
+#endif
+    free(self);
+}
+
+// Wait-free: the capture happens outside the slot's odd window, which only
+// covers a 256 byte pack
+void feed_publish(FeedState* self, PlayState* play, Config* config) {
+    net_snapshot_capture(&self->snapshot, play, config);
+
+    FeedSlot* slot = &self->header->slots[play->tick & (FEED_SLOTS - 1)];
+    int sequence = slot->sequence.value; // only this thread writes it
+    SDL_AtomicSet(&slot->sequence, sequence + 1);
+    slot->tick = play->tick;
+    net_snapshot_pack(&self->snapshot, slot->data);
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&slot->sequence, sequence + 2);
+    SDL_AtomicSet(&self->header->latestTick, (int)play->tick);
+}
+
+// Copies a tick out of the ring. False when the writer is mid-slot or has
+// already lapped it. Plain loads only, the mapping may be read only.
+bool feed_read(FeedState* self, uint32 tick, uint8* out) {
+    FeedSlot* slot = &self->header->slots[tick & (FEED_SLOTS - 1)];
+    volatile int* sequence = &slot->sequence.value;
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        int before = *sequence;
+        if (before & 1) {
+            continue;
         }
-        if (shield->texture.data) {
-            free(shield->texture.data);
-            shield->texture.data = NULL;
+        SDL_MemoryBarrierAcquire();
+        uint32 slotTick = *(volatile uint32*)&slot->tick;
+        SDL_memcpy(out, slot->data, NET_SNAPSHOT_BYTES);
+        SDL_MemoryBarrierAcquire();
+        if (*sequence == before) {
+            return slotTick == tick;
         }
     }
+    return false;
+}
 
-    for (int i = 0; i < MAX_BULLETS; ++i) {
-        bullet_reset(&self->bullets[i]);
+// Example reader: follows a running game's feed and logs once a second
+int feed_monitor_run(Options* options) {
+    FeedState* feed = feed_start(options->feedReadName, false);
+    if (!feed) {
+        return 1;
     }
 
-    const int spacing = 4;
-    const int offsetX = 10;
-    const int offsetY = 20;
-    for (int i = 0; i < MAX_INVADERS; ++i) {
-        int row = i / INVADER_COLS;
-        int col = i % INVADER_COLS;
-        int x = col * (spacing + 13) + offsetX;
-        int y = row * (spacing + 8) + offsetY;
-        int invaderType = 0;
-        switch (row) {
-            case 0: invaderType = 2; break;
-            case 1:
-            case 2: invaderType = 1; break;
+    uint64 frequency = SDL_GetPerformanceFrequency();
+    uint64 start = SDL_GetPerformanceCounter();
+    uint64 deadline = start + (uint64)(options->feedReadSeconds * frequency);
+    uint64 nextReport = start + frequency;
+    volatile int* latestTick = &feed->header->latestTick.value;
+    uint32 lastTick = (uint32)*latestTick;
+    uint32 read = 0, missed = 0, corrupt = 0;
+    NetSnapshot snapshot;
+    SDL_memset(&snapshot, 0, sizeof(snapshot));
+
+    for (uint64 now = start; now < deadline; now = SDL_GetPerformanceCounter()) {
+        uint32 latest = (uint32)*latestTick;
+        if (latest - lastTick > FEED_SLOTS) {
+            // fell more than a ring behind
+            missed += latest - lastTick - FEED_SLOTS;
+            lastTick = latest - FEED_SLOTS;
+        }
+        for (uint32 tick = lastTick + 1; tick - 1 != latest; ++tick) {
+            uint8 data[NET_SNAPSHOT_BYTES];
+            if (!feed_read(feed, tick, data)) {
+                ++missed;
+                continue;
+            }
+            net_snapshot_unpack(&snapshot, data);
+            if (snapshot.tick != tick) {
+                ++corrupt;
+            }
+            ++read;
+        }
+        lastTick = latest;
+
+        if (now >= nextReport) {
+            int alive = 0;
+            for (int i = 0; i < MAX_INVADERS; ++i) {
+                alive += (snapshot.invaderActive[i / 8] >> (i % 8)) & 1;
+            }
+            SDL_Log("feed: tick %u score %u lives %u wave %u invaders %d | %u read, %u missed, %u corrupt",
+                snapshot.tick, snapshot.score, snapshot.lives, snapshot.wave, alive, read, missed, corrupt);
+            nextReport += frequency;
+        }
+        SDL_Delay(1);
+    }
+
+    feed_stop(feed);
+    return corrupt ? 1 : 0;
+}
+
+bool audio_init(AudioState* self) {
+    SDL_memset(self, 0, sizeof(*self));
+    for (int i = 0; i < MAX_VOICES; ++i) {
+        self->voices[i].sound = -1;
+    }
+
+    // SDL_AUDIODRIVER=dummy runs the whole mixer without an output device
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        SDL_Log("audio disabled: %s", SDL_GetError());
+        return false;
+    }
+
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = AUDIO_SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = AUDIO_BUFFER_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = self;
+
+    self->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (self->device == 0) {
+        SDL_Log("audio disabled: %s", SDL_GetError());
+        return false;
+    }
+    self->sampleRate = have.freq;
+
+    SDL_PauseAudioDevice(self->device, 0);
+    return true;
+}
+
+void audio_shutdown(AudioState* self) {
+    if (self->device) {
+        SDL_CloseAudioDevice(self->device);
+        self->device = 0;
+    }
+}
+
+bool audio_play(AudioState* self, SoundId sound) {
+    if (!self->device) {
+        return false;
+    }
+    AudioCommand command = { AudioCommand_Play, (uint8)sound };
+    return audio_queue_push(&self->queue, command);
+}
+
+bool audio_stop(AudioState* self, SoundId sound) {
+    if (!self->device) {
+        return false;
+    }
+    AudioCommand command = { AudioCommand_Stop, (uint8)sound };
+    return audio_queue_push(&self->queue, command);
+}
+
+void audio_post_events(AudioState* self, EventList* events) {
+    for (int i = 0; i < events->count; ++i) {
+        GameEvent* event = &events->events[i];
+        switch (event->type) {
+            case GameEvent_TankShot: audio_play(self, Sound_TankShot); break;
+            case GameEvent_InvaderShot: audio_play(self, Sound_InvaderShot); break;
+            case GameEvent_InvaderMarch: audio_play(self, Sound_March1 + (event->param & 0x3)); break;
+            case GameEvent_InvaderKilled: audio_play(self, Sound_InvaderExplosion); break;
+            case GameEvent_TankHit: audio_play(self, Sound_TankExplosion); break;
+            case GameEvent_UfoEnter: audio_play(self, Sound_Ufo); break;
+            case GameEvent_UfoLeave: audio_stop(self, Sound_Ufo); break;
+            case GameEvent_UfoKilled:
+                audio_stop(self, Sound_Ufo);
+                audio_play(self, Sound_InvaderExplosion);
+                break;
             default: break;
         }
-        invader_reset(&self->invaders[i], x, y, invaderType);
     }
-    self->moveDelay = g_config.invaderMoveDelay.max;
-    self->moveIndex = 0;
-    for (int i = 0; i < INVADER_MOVE_QUEUE_SIZE; ++i) {
-        self->moveQueue[i] = InvaderMove_Right;
+}
+
+bool audio_queue_push(AudioQueue* self, AudioCommand command) {
+    int head = SDL_AtomicGet(&self->head);
+    int tail = SDL_AtomicGet(&self->tail);
+    if (head - tail >= AUDIO_QUEUE_SIZE) {
+        // full, drop rather than wait on the audio thread
+        return false;
     }
+    self->commands[head & (AUDIO_QUEUE_SIZE - 1)] = command;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&self->head, head + 1);
+    return true;
 }
 
-void tank_reset(TankState* self) {
-    self->target.position.x = cScreenWidth / 2;
-    self->target.position.y = cScreenHeight - 8;
-    self->target.width = 13;
-    self->target.height = 8;
-    self->mode = TankMode_Active;
-    for (int i = 0; i < MAX_TANK_BULLETS; ++i) {
-        self->bullets[i] = -1;
+bool audio_queue_pop(AudioQueue* self, AudioCommand* command) {
+    int tail = SDL_AtomicGet(&self->tail);
+    int head = SDL_AtomicGet(&self->head);
+    if (tail == head) {
+        return false;
     }
+    SDL_MemoryBarrierAcquire();
+    *command = self->commands[tail & (AUDIO_QUEUE_SIZE - 1)];
+    SDL_AtomicSet(&self->tail, tail + 1);
+    return true;
 }
 
-void bullet_reset(BulletState* self) {
-    self->target.position.x = 0;
-    self->target.position.y = 0;
-    self->target.width = 0;
-    self->target.height = 0;
-    self->active = false;
-    self->frame = 0;
-    self->frameCount = 1;
-    self->baseTexture = 8;
-    self->direction = -1;
-    self->ownerHandle = NULL;
+void audio_callback(void* userdata, uint8* stream, int len) {
+    AudioState* self = (AudioState*)userdata;
+
+    AudioCommand command;
+    while (audio_queue_pop(&self->queue, &command)) {
+        if (command.type == AudioCommand_Stop) {
+            for (int i = 0; i < MAX_VOICES; ++i) {
+                if (self->voices[i].sound == command.sound) {
+                    self->voices[i].sound = -1;
+                }
+            }
+            continue;
+        }
+
+        // take an idle voice, otherwise steal the quietest one
+        Voice* target = &self->voices[0];
+        for (int i = 0; i < MAX_VOICES; ++i) {
+            Voice* voice = &self->voices[i];
+            if (voice->sound < 0) {
+                target = voice;
+                break;
+            }
+            if (voice->gain < target->gain) {
+                target = voice;
+            }
+        }
+        voice_start(target, command.sound, self->sampleRate);
+    }
+
+    int16* out = (int16*)stream;
+    int count = len / (int)sizeof(int16);
+
+    int32 accum[AUDIO_BUFFER_SAMPLES];
+    while (count > 0) {
+        int chunk = (count < AUDIO_BUFFER_SAMPLES) ? count : AUDIO_BUFFER_SAMPLES;
+        for (int i = 0; i < chunk; ++i) {
+            accum[i] = 0;
+        }
+        for (int i = 0; i < MAX_VOICES; ++i) {
+            if (self->voices[i].sound >= 0) {
+                voice_mix(&self->voices[i], accum, chunk);
+            }
+        }
+        for (int i = 0; i < chunk; ++i) {
+            int32 v = accum[i];
+            out[i] = (int16)((v > 32767) ? 32767 : (v < -32768) ? -32768 : v);
+        }
+        out += chunk;
+        count -= chunk;
+    }
 }
 
-void bullet_remove(BulletState* self) {
-    self->active = false;
-    if (self->ownerHandle) {
-        *self->ownerHandle = -1;
-        self->ownerHandle = NULL;
+void voice_start(Voice* self, SoundId sound, int sampleRate) {
+    const SoundDef* def = &cSoundTable[sound];
+    float32 cycle = 4294967296.f / (float32)sampleRate;
+
+    self->sound = sound;
+    self->waveform = def->waveform;
+    self->phase = 0;
+    self->phaseStep = (uint32)(def->startFreq * cycle);
+    self->lfoPhase = 0;
+    self->lfoStep = (uint32)(def->warbleFreq * cycle);
+    self->lfoDepth = (int32)(def->warbleDepth * cycle);
+    self->gain = (int32)(def->volume * 65536.f);
+    self->noise = 0x1234567u;
+
+    if (def->duration > 0.f) {
+        self->samplesLeft = (int32)(def->duration * sampleRate);
+        self->phaseSweep = (int32)((def->endFreq - def->startFreq) * cycle / self->samplesLeft);
+        self->gainStep = self->gain / self->samplesLeft;
+    }
+    else {
+        self->samplesLeft = -1;
+        self->phaseSweep = 0;
+        self->gainStep = 0;
     }
 }
 
-void bullet_create(BulletState* self, int x, int y, int bulletType, int* ownerHandle) {
-    self->target.position.x = x;
-    self->target.position.y = y;
-    self->active = true;
-    self->frame = 0;
-    self->ownerHandle = ownerHandle;
+void voice_mix(Voice* self, int32* accum, int count) {
+    for (int i = 0; i < count; ++i) {
+        if (self->samplesLeft == 0 || self->gain <= 0) {
+            self->sound = -1;
+            return;
+        }
 
-    switch (bulletType) {
-        default:
-        case 0:
-            self->target.width = 1;
-            self->target.height = 3;
-            self->frameCount = 1;
-            self->baseTexture = 8;
-            self->direction = -1;
-            break;
+        // triangle lfo in [-32768, 32767] bends the pitch for the warble
+        uint32 tri = (self->lfoPhase & 0x80000000u) ? ~self->lfoPhase : self->lfoPhase;
+        int32 lfo = (int32)(tri >> 15) - 32768;
+        uint32 step = self->phaseStep + (uint32)(((int64)self->lfoDepth * lfo) >> 15);
+
+        uint32 prevPhase = self->phase;
+        self->phase += step;
+
+        int32 amp = (self->gain * AUDIO_VOICE_AMPLITUDE) >> 16;
+        bool high;
+        if (self->waveform == Waveform_Noise) {
+            // clock the noise generator once per wrap so the pitch shapes it
+            if (self->phase < prevPhase) {
+                self->noise ^= self->noise << 13;
+                self->noise ^= self->noise >> 17;
+                self->noise ^= self->noise << 5;
+            }
+            high = self->noise & 1;
+        }
+        else {
+            high = (self->phase & 0x80000000u) != 0;
+        }
+        accum[i] += high ? amp : -amp;
 
-        case 1:
-            self->target.width = 3;
-            self->target.height = 5;
-            self->frameCount = 2;
-            self->baseTexture = 9;
-            self->direction = 1;
-            break;
+        self->lfoPhase += self->lfoStep;
+        self->phaseStep += self->phaseSweep;
+        self->gain -= self->gainStep;
+        if (self->samplesLeft > 0) {
+            --self->samplesLeft;
+        }
     }
 }
 
-void invader_reset(InvaderState* self, int x, int y, int invaderType) {
-    self->target.position.x = x;
-    self->target.position.y = y;
-    self->target.width = cInvaderWidthTable[invaderType];
-    self->target.height = cInvaderHeightTable[invaderType];
-    self->active = true;
-    self->moveDelay = 0.f;
-    self->fireDelay = range_rand(&g_config.invaderFireDelay);
-    self->invaderType = invaderType;
-    self->frame = 0;
-    for (int i = 0; i < MAX_INVADER_BULLETS; ++i) {
-        self->bullets[i] = -1;
+// Puts a width x height image at the packer's cursor, starting a new shelf
+// when the current one is full. Images keep a pixel between them so scaling
+// never bleeds a neighbour in.
+bool atlas_packer_place(AtlasPacker* self, int width, int height, SDL_Rect* rect) {
+    if (self->x + width > ATLAS_WIDTH) {
+        self->x = 0;
+        self->y += self->shelf + 1;
+        self->shelf = 0;
     }
+    if (self->y + height > ATLAS_HEIGHT) {
+        return false;
+    }
+    rect->x = self->x;
+    rect->y = self->y;
+    rect->w = width;
+    rect->h = height;
+    self->x += width + 1;
+    self->shelf = SDL_max(self->shelf, height);
+    return true;
 }
 
-void shield_damage(ShieldState* self, Game* game, int32* indices, int32 count) {
-    if (!self->texture.texture) {
-        self->texture = create_palette_image_texture(game->renderer,
-            cShieldImageData,
-            18, 14,
-            cColorPalette);
+// Packs every sprite, then the glyphs, into the atlas on shelves and colors
+// them from palette
+bool sprite_atlas_bake(SpriteAtlas* self, const SDL_Color* palette) {
+    SDL_memset(self, 0, sizeof(*self));
+    AtlasPacker packer = { 0, 0, 0 };
+    for (int i = 0; i < SPRITE_COUNT; ++i) {
+        const Sprite* sprite = &cSprites[i];
+        SDL_Rect* rect = &self->rects[i];
+        if (sprite->width > 32 || sprite->height > SPRITE_MAX_HEIGHT ||
+            !atlas_packer_place(&packer, sprite->width, sprite->height, rect)) {
+            SDL_Log("sprites: sprite %d (%dx%d) doesn't fit the atlas", i, sprite->width, sprite->height);
+            return false;
+        }
+
+        sprite_mask_rows(sprite->data, sprite->width, sprite->height, self->masks[i]);
+        for (int row = 0; row < sprite->height; ++row) {
+            for (int col = 0; col < sprite->width; ++col) {
+                uint8 value = sprite->data[row * sprite->width + col];
+                if (value != 0) {
+                    self->pixels[(rect->y + row) * ATLAS_WIDTH + rect->x + col] = sprite_atlas_pixel(palette[value - 1]);
+                }
+            }
+        }
+    }
+
+    // the HUD only ever draws text in the first color
+    const uint32 ink = sprite_atlas_pixel(palette[0]);
+    for (int i = 0; i < GLYPH_COUNT; ++i) {
+        SDL_Rect* rect = &self->glyphs[i];
+        if (!atlas_packer_place(&packer, GLYPH_WIDTH, GLYPH_HEIGHT, rect)) {
+            SDL_Log("sprites: glyph '%c' doesn't fit the atlas", GLYPH_FIRST + i);
+            return false;
+        }
+        for (int bit = 0; bit < GLYPH_WIDTH * GLYPH_HEIGHT; ++bit) {
+            if ((cGlyphData[i] >> (GLYPH_WIDTH * GLYPH_HEIGHT - 1 - bit)) & 1) {
+                self->pixels[(rect->y + bit / GLYPH_WIDTH) * ATLAS_WIDTH + rect->x + bit % GLYPH_WIDTH] = ink;
+            }
+        }
     }
+    return true;
 }
 
-void input_reset(InputState* self) {
-    for (int i = 0; i < 512; ++i) {
-        self->prevKeys[i] = false;
-        self->currKeys[i] = false;
+// Premultiplied ABGR8888, so a transparent pixel is all zeros
+uint32 sprite_atlas_pixel(SDL_Color c) {
+    uint32 r = c.r * c.a / 255, g = c.g * c.a / 255, b = c.b * c.a / 255;
+    return (uint32)c.a << 24 | b << 16 | g << 8 | r;
+}
+
+// Writes the atlas out as a C header for VASION_BAKED_SPRITES builds
+int sprite_atlas_write(const SpriteAtlas* self, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        SDL_Log("sprites: can't write %s", path);
+        return 1;
+    }
+    fprintf(file, "// Baked by vasion --bake-sprites from the sprite tables in vasion.c, don't edit\n");
+    fprintf(file, "static const SpriteAtlas cSpriteAtlas = {\n    {\n");
+    for (int i = 0; i < SPRITE_COUNT; ++i) {
+        const SDL_Rect* r = &self->rects[i];
+        fprintf(file, "        { %d, %d, %d, %d },\n", r->x, r->y, r->w, r->h);
+    }
+    fprintf(file, "    },\n    {\n");
+    for (int i = 0; i < GLYPH_COUNT; ++i) {
+        const SDL_Rect* r = &self->glyphs[i];
+        fprintf(file, "        { %d, %d, %d, %d },\n", r->x, r->y, r->w, r->h);
+    }
+    fprintf(file, "    },\n    {\n");
+    for (int i = 0; i < SPRITE_COUNT; ++i) {
+        fprintf(file, "        {");
+        for (int j = 0; j < SPRITE_MAX_HEIGHT; ++j) {
+            fprintf(file, " 0x%08x,", self->masks[i][j]);
+        }
+        fprintf(file, " },\n");
+    }
+    fprintf(file, "    },\n    {\n");
+    for (int i = 0; i < ATLAS_WIDTH * ATLAS_HEIGHT; i += 8) {
+        fprintf(file, "       ");
+        for (int j = i; j < i + 8; ++j) {
+            fprintf(file, " 0x%08x,", self->pixels[j]);
+        }
+        fprintf(file, "\n");
     }
+    fprintf(file, "    },\n};\n");
+    fclose(file);
+    SDL_Log("sprites: baked %d sprites and %d glyphs into %s", SPRITE_COUNT, GLYPH_COUNT, path);
+    return 0;
 }
 
-void input_update(InputState* self) {
-    for (int i = 0; i < 512; ++i) {
-        self->prevKeys[i] = self->currKeys[i];
+// A word per row with bit x set where column x of data is drawn
+void sprite_mask_rows(const uint8* data, int width, int height, uint32* mask) {
+    for (int row = 0; row < height; ++row) {
+        uint32 bits = 0;
+        for (int col = 0; col < width; ++col) {
+            bits |= (uint32)(data[row * width + col] != 0) << col;
+        }
+        mask[row] = bits;
     }
 }
 
-void input_set_key(InputState* self, int scancode, bool isDown) {
-    self->currKeys[scancode] = isDown;
+bool arena_init(Arena* self, size_t capacity) {
+    SDL_memset(self, 0, sizeof(*self));
+    self->base = (uint8*)malloc(capacity);
+    if (!self->base) {
+        SDL_Log("arena: could not allocate %u bytes", (uint32)capacity);
+        return false;
+    }
+    self->capacity = capacity;
+    return true;
 }
 
-bool input_get_key(InputState* self, int scancode) {
-    return self->currKeys[scancode];
+void arena_free(Arena* self) {
+    free(self->base);
+    SDL_memset(self, 0, sizeof(*self));
 }
 
-bool input_get_down(InputState* self, int scancode) {
-    return self->currKeys[scancode] && !self->prevKeys[scancode];
+// Aligned to ARENA_ALIGN. Arenas are sized up front for their worst case,
+// running out is a sizing bug, so it stops right there rather than hand a
+// caller NULL.
+void* arena_push(Arena* self, size_t size) {
+    size_t offset = (self->used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (offset + size > self->capacity) {
+        SDL_Log("arena: out of memory, %u of %u bytes used, %u more wanted",
+            (uint32)self->used, (uint32)self->capacity, (uint32)size);
+        abort();
+    }
+    self->used = offset + size;
+    self->peak = SDL_max(self->peak, self->used);
+    return self->base + offset;
 }
 
-bool input_get_up(InputState* self, int scancode) {
-    return !self->currKeys[scancode] && self->prevKeys[scancode];
+void arena_reset(Arena* self) {
+    self->used = 0;
 }
 
-PaletteTexture create_palette_image_texture(SDL_Renderer* renderer, uint8* data, int width, int height, SDL_Color* palette) {
-    SDL_Surface* surface = SDL_CreateRGBSurface(0, width, height, 32, 0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000);
+size_t arena_mark(Arena* self) {
+    return self->used;
+}
 
-    const int size = width * height;
-    for (int i = 0; i < size; ++i) {
-        SDL_Color color = {
-            0, 0, 0, 0,
-        };
+// Frees everything pushed since the mark was taken
+void arena_release(Arena* self, size_t mark) {
+    self->used = mark;
+}
 
-        uint8 value = data[i];
-        if (value > 0) {
-            color = palette[value - 1];
-        }
+void rng_seed(Rng* self, uint32 seed) {
+    // xorshift must never hold zero
+    self->state = seed ? seed : 0x9e3779b9u;
+}
 
-        uint32 packedColor = SDL_MapRGBA(surface->format, color.r, color.g, color.b, color.a);
+uint32 rng_next(Rng* self) {
+    uint32 x = self->state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    self->state = x;
+    return x;
+}
 
-        SDL_Rect r = {
-            i % width, i / width,
-            1, 1
-        };
-        SDL_FillRect(surface, &r, packedColor);
+fixed range_rand(Range* range, Rng* rng) {
+    return lerp(range->min, range->max, (fixed)(rng_next(rng) >> (32 - FX_SHIFT)));
+}
+
+uint64 hash_mix(uint64 hash, uint32 value) {
+    // FNV-1a over the little endian bytes, independent of struct layout
+    for (int i = 0; i < 4; ++i) {
+        hash ^= (value >> (i * 8)) & 0xff;
+        hash *= 0x100000001b3ull;
     }
+    return hash;
+}
 
-    SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
-    SDL_FreeSurface(surface);
+uint64 hash_rect(uint64 hash, Rect* rect) {
+    hash = hash_mix(hash, (uint32)rect->position.x);
+    hash = hash_mix(hash, (uint32)rect->position.y);
+    hash = hash_mix(hash, (uint32)rect->width);
+    return hash_mix(hash, (uint32)rect->height);
+}
 
-    PaletteTexture result = {
-        texture, data, width, height,
-    };
+uint64 play_hash(PlayState* self) {
+    uint64 hash = 0xcbf29ce484222325ull;
+    hash = hash_mix(hash, self->tick);
+    hash = hash_mix(hash, self->rng.state);
+    hash = hash_mix(hash, (uint32)self->moveIndex);
+    hash = hash_mix(hash, (uint32)self->moveDelay);
+
+    hash = hash_mix(hash, self->score);
+    hash = hash_mix(hash, (uint32)self->lives);
+    hash = hash_mix(hash, (uint32)self->wave);
+    hash = hash_mix(hash, (uint32)self->aimColumn);
+    hash = hash_mix(hash, (uint32)self->aimDelay);
+    hash = hash_mix(hash, (uint32)self->versusFireDelay);
+
+    hash = hash_rect(hash, &self->tank.target);
+    hash = hash_mix(hash, (uint32)self->tank.mode);
+    hash = hash_mix(hash, (uint32)self->tank.respawnDelay);
+    for (int i = 0; i < MAX_TANK_BULLETS; ++i) {
+        hash = hash_mix(hash, (uint32)self->tank.bullets[i]);
+    }
 
-    return result;
-}
+    for (int i = 0; i < MAX_BULLETS; ++i) {
+        BulletState* bullet = &self->bullets[i];
+        hash = hash_mix(hash, bullet->active);
+        if (bullet->active) {
+            hash = hash_rect(hash, &bullet->target);
+            hash = hash_mix(hash, (uint32)bullet->direction);
+            hash = hash_mix(hash, (uint32)bullet->frame);
+        }
+    }
+
+    for (int i = 0; i < MAX_INVADERS; ++i) {
+        InvaderState* invader = &self->invaders[i];
+        hash = hash_mix(hash, invader->active);
+        hash = hash_rect(hash, &invader->target);
+        hash = hash_mix(hash, (uint32)invader->fireDelay);
+        hash = hash_mix(hash, (uint32)invader->deathTime);
+        hash = hash_mix(hash, (uint32)invader->frame);
+        for (int j = 0; j < MAX_INVADER_BULLETS; ++j) {
+            hash = hash_mix(hash, (uint32)invader->bullets[j]);
+        }
+        hash = hash_mix(hash, invader->diving);
+        hash = hash_mix(hash, (uint32)invader->diveOffset.x);
+        hash = hash_mix(hash, (uint32)invader->diveOffset.y);
+    }
+
+    hash = hash_rect(hash, &self->ufo.target);
+    hash = hash_mix(hash, self->ufo.active);
+    hash = hash_mix(hash, (uint32)self->ufo.direction);
+    hash = hash_mix(hash, (uint32)self->ufo.deathTime);
+
+    hash = hash_mix(hash, self->scriptEvents);
+    hash = hash_mix(hash, (uint32)self->diverCount);
+    for (int i = 0; i < MAX_SCRIPT_TASKS; ++i) {
+        ScriptTask* task = &self->scripts[i];
+        hash = hash_mix(hash, (uint32)(task->script | task->wait << 8 | task->resume << 16));
+        hash = hash_mix(hash, (uint32)task->until);
+        hash = hash_mix(hash, (uint32)(uint16)task->target | (uint32)(uint16)task->counter << 16);
+    }
 
-float32 range_rand(Range* range) {
-    return lerp(range->min, range->max, (float32)rand() / (float32)RAND_MAX);
+    for (int i = 0; i < MAX_SHIELDS; ++i) {
+        const uint8* pixels = self->shields[i].pixels;
+        for (int j = 0; j + 4 <= SHIELD_WIDTH * SHIELD_HEIGHT; j += 4) {
+            hash = hash_mix(hash, (uint32)(pixels[j] | pixels[j + 1] << 8 | pixels[j + 2] << 16 | pixels[j + 3] << 24));
+        }
+    }
+    return hash;
 }
 
 void bounds_grow(Bounds* self, Point* point) {
@@ -1063,10 +7303,10 @@ Bounds bounds_from_rect(Rect* rect) {
 
 IBounds ibounds_from_rect(Rect* rect) {
     IBounds result = {
-        (int32)(rect->position.x - rect->width / 2),
-        (int32)(rect->position.x + rect->width / 2),
-        (int32)(rect->position.y - rect->height / 2),
-        (int32)(rect->position.y + rect->height / 2),
+        fx_to_int(rect->position.x - rect->width / 2),
+        fx_to_int(rect->position.x + rect->width / 2),
+        fx_to_int(rect->position.y - rect->height / 2),
+        fx_to_int(rect->position.y + rect->height / 2),
     };
     return result;
 }
@@ -1089,11 +7329,11 @@ void ibounds_extract_union(IBounds* a, IBounds* b, IBounds* dest) {
 Rect rect_from_bounds(Bounds* bounds) {
     Rect result = {
         {
-            (bounds->left + bounds->right) / 2.f,
-            (bounds->top + bounds->bottom) / 2.f,
+            (bounds->left + bounds->right) / 2,
+            (bounds->top + bounds->bottom) / 2,
         },
-        fabs(bounds->right - bounds->left),
-        fabs(bounds->bottom - bounds->top),
+        fx_abs(bounds->right - bounds->left),
+        fx_abs(bounds->bottom - bounds->top),
     };
     return result;
 }
@@ -1106,7 +7346,102 @@ bool rect_intersects(Rect* a, Rect* b) {
         ab.left <= bb.right && ab.right >= bb.left;
 }
 
-bool px_to_px_intersect(Rect* a, Rect* b, PaletteTexture* texA, PaletteTexture* texB, PxCollisionData* data) {
+void bounds_batch_set(BoundsBatch* self, int index, const Bounds* bounds) {
+    self->left[index] = bounds->left;
+    self->right[index] = bounds->right;
+    self->top[index] = bounds->top;
+    self->bottom[index] = bounds->bottom;
+}
+
+void bounds_batch_clear(BoundsBatch* self, int index) {
+    self->left[index] = BOUNDS_EMPTY;
+    self->right[index] = -BOUNDS_EMPTY;
+    self->top[index] = BOUNDS_EMPTY;
+    self->bottom[index] = -BOUNDS_EMPTY;
+}
+
+void bounds_batch_translate(BoundsBatch* self, int count, fixed dx, fixed dy) {
+    for (int i = 0; i < count; ++i) {
+        self->left[i] += dx;
+        self->right[i] += dx;
+        self->top[i] += dy;
+        self->bottom[i] += dy;
+    }
+}
+
+// Bit i is set when entry i overlaps query, edges touching counting as
+// overlap exactly like rect_intersects. Eight or four entries per step, then
+// scalar for whatever is left.
+uint64 bounds_overlap_mask(const Bounds* query, const BoundsBatch* batch, int count) {
+    uint64 mask = 0;
+    int i = 0;
+
+#ifdef VASION_AVX2
+    {
+        const __m256i qLeft = _mm256_set1_epi32(query->left);
+        const __m256i qRight = _mm256_set1_epi32(query->right);
+        const __m256i qTop = _mm256_set1_epi32(query->top);
+        const __m256i qBottom = _mm256_set1_epi32(query->bottom);
+        for (; i + 8 <= count; i += 8) {
+            __m256i miss = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpgt_epi32(qLeft, _mm256_loadu_si256((const __m256i*)(batch->right + i))),
+                    _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(batch->left + i)), qRight)),
+                _mm256_or_si256(_mm256_cmpgt_epi32(qTop, _mm256_loadu_si256((const __m256i*)(batch->bottom + i))),
+                    _mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)(batch->top + i)), qBottom)));
+            uint64 bits = ~(uint32)_mm256_movemask_ps(_mm256_castsi256_ps(miss)) & 0xff;
+            mask |= bits << i;
+        }
+    }
+#endif
+
+#ifdef VASION_SSE2
+    {
+        // separated on any axis is a miss, the rest overlap
+        const __m128i qLeft = _mm_set1_epi32(query->left);
+        const __m128i qRight = _mm_set1_epi32(query->right);
+        const __m128i qTop = _mm_set1_epi32(query->top);
+        const __m128i qBottom = _mm_set1_epi32(query->bottom);
+        for (; i + 4 <= count; i += 4) {
+            __m128i miss = _mm_or_si128(
+                _mm_or_si128(_mm_cmpgt_epi32(qLeft, _mm_loadu_si128((const __m128i*)(batch->right + i))),
+                    _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(batch->left + i)), qRight)),
+                _mm_or_si128(_mm_cmpgt_epi32(qTop, _mm_loadu_si128((const __m128i*)(batch->bottom + i))),
+                    _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)(batch->top + i)), qBottom)));
+            uint64 bits = ~(uint32)_mm_movemask_ps(_mm_castsi128_ps(miss)) & 0xf;
+            mask |= bits << i;
+        }
+    }
+#endif
+
+    for (; i < count; ++i) {
+        bool overlap = query->left <= batch->right[i] && batch->left[i] <= query->right &&
+            query->top <= batch->bottom[i] && batch->top[i] <= query->bottom;
+        mask |= (uint64)overlap << i;
+    }
+    return mask;
+}
+
+int bit_lowest(uint64 mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctzll(mask);
+#endif
+}
+
+int bit_highest(uint32 value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, value);
+    return (int)index;
+#else
+    return 31 - __builtin_clz(value);
+#endif
+}
+
+bool px_to_px_intersect(Rect* a, Rect* b, const Sprite* spriteA, const Sprite* spriteB, PxCollisionData* data) {
     if (data) {
         data->pixelA = 0;
         data->pixelB = 0;
@@ -1117,69 +7452,152 @@ bool px_to_px_intersect(Rect* a, Rect* b, PaletteTexture* texA, PaletteTexture*
         return false;
     }
 
-    IBounds ai = ibounds_from_rect(a);
-    IBounds bi = ibounds_from_rect(b);
-
-    IBounds areaA, areaB;
+    // pixel origins match what rect_to_sdl draws
+    SDL_Rect ra, rb;
+    rect_to_sdl(a, &ra);
+    rect_to_sdl(b, &rb);
+
+    // overlap of the two images, right and bottom exclusive
+    int32 left = SDL_max(ra.x, rb.x);
+    int32 right = SDL_min(ra.x + spriteA->width, rb.x + spriteB->width);
+    int32 top = SDL_max(ra.y, rb.y);
+    int32 bottom = SDL_min(ra.y + spriteA->height, rb.y + spriteB->height);
+    if (left >= right) {
+        return false;
+    }
 
-    ibounds_extract_union(&ai, &bi, &areaA);
-    ibounds_extract_union(&bi, &ai, &areaB);
+    // a row at a time from the masks, the lowest common bit is the leftmost
+    // pixel, so the first hit is the same one a pixel by pixel scan finds
+    for (int32 row = top; row < bottom; ++row) {
+        uint32 bits = (spriteA->mask[row - ra.y] >> (left - ra.x)) & (spriteB->mask[row - rb.y] >> (left - rb.x));
+        if (bits) {
+            int32 col = left + bit_lowest(bits);
+            if (data) {
+                data->pixelA = (row - ra.y) * spriteA->width + (col - ra.x);
+                data->pixelB = (row - rb.y) * spriteB->width + (col - rb.x);
+            }
+            return true;
+        }
+    }
 
-    IPoint topLeftA = { areaA.left, areaA.top };
-    IPoint topLeftB = { areaB.left, areaB.top };
+    return false;
+}
 
-    for (int32 row = ai.top; row <= ai.bottom; ++row) {
-        for (int32 col = ai.left; col <= ai.right; ++col) {
-            int32 ar = row - topLeftA.y;
-            int32 ac = col - topLeftA.x;
-            int32 br = row - topLeftB.y;
-            int32 bc = col - topLeftB.x;
+// Swept AABB for a rect moving vertically from `from` to `to`. On a hit
+// distance is how far it travelled before first touching target, 0 if it
+// started out overlapping.
+bool sweep_vertical(Rect* target, Rect* from, Rect* to, fixed* distance) {
+    Bounds tb = bounds_from_rect(target);
+    Bounds fb = bounds_from_rect(from);
+    Bounds eb = bounds_from_rect(to);
 
-            int32 indexA = ar * texA->width + ac;
-            int32 indexB = br * texB->width + bc;
+    if (fb.left > tb.right || fb.right < tb.left) {
+        return false;
+    }
 
-            if (texA->data[indexA] && texB->data[indexB]) {
-                if (data) {
-                    data->pixelA = indexA;
-                    data->pixelB = indexB;
-                    return true;
-                }
-            }
+    if (eb.top <= fb.top) {
+        // moving up, leading edge is the top
+        if (eb.top > tb.bottom || fb.bottom < tb.top) {
+            return false;
+        }
+        *distance = SDL_max(fb.top - tb.bottom, 0);
+    }
+    else {
+        if (eb.bottom < tb.top || fb.top > tb.bottom) {
+            return false;
         }
+        *distance = SDL_max(tb.top - fb.bottom, 0);
     }
+    return true;
+}
 
-    return false;
+// Steps spriteB one pixel row at a time from `from` to `to` in travel order
+// and returns the number of rows moved before its set pixels first overlap
+// spriteA's, or -1 if they never do.
+int32 px_sweep_vertical(Rect* a, const Sprite* spriteA, Rect* from, Rect* to, const Sprite* spriteB, PxCollisionData* data) {
+    SDL_Rect rf, rt;
+    rect_to_sdl(from, &rf);
+    rect_to_sdl(to, &rt);
+
+    int32 rows = rt.y - rf.y;
+    int32 step = (rows < 0) ? -1 : 1;
+    rows = (rows < 0) ? -rows : rows;
+
+    // skip straight to the rows where the boxes can overlap at all
+    SDL_Rect ra;
+    rect_to_sdl(a, &ra);
+    int32 first = 0;
+    if (step > 0 && rf.y + spriteB->height <= ra.y) {
+        first = ra.y - (rf.y + spriteB->height) + 1;
+    }
+    else if (step < 0 && rf.y >= ra.y + spriteA->height) {
+        first = rf.y - (ra.y + spriteA->height) + 1;
+    }
+
+    Rect moved = *from;
+    for (int32 k = first; k <= rows; ++k) {
+        moved.position.y = from->position.y + fx_from_int(k * step);
+        if (px_to_px_intersect(a, &moved, spriteA, spriteB, data)) {
+            return k;
+        }
+    }
+    return -1;
 }
 
 void rect_to_sdl(Rect* rect, SDL_Rect* dest) {
-    int hw = rect->width / 2;
-    int hh = rect->height / 2;
-    dest->x = (int)rect->position.x - hw;
-    dest->y = (int)rect->position.y - hh;
-    dest->w = (int)rect->width;
-    dest->h = (int)rect->height;
+    int hw = fx_to_int(rect->width) / 2;
+    int hh = fx_to_int(rect->height) / 2;
+    dest->x = fx_to_int(rect->position.x) - hw;
+    dest->y = fx_to_int(rect->position.y) - hh;
+    dest->w = fx_to_int(rect->width);
+    dest->h = fx_to_int(rect->height);
+}
+
+fixed fx_from_int(int32 v) {
+    return v * FX_ONE;
+}
+
+int32 fx_to_int(fixed v) {
+    // arithmetic shift, rounds toward negative infinity
+    return v >> FX_SHIFT;
+}
+
+float32 fx_to_float(fixed v) {
+    return (float32)v / FX_ONE;
+}
+
+fixed fx_mul(fixed a, fixed b) {
+    return (fixed)(((int64)a * b) >> FX_SHIFT);
+}
+
+fixed fx_div(fixed a, fixed b) {
+    return (fixed)(((int64)a * FX_ONE) / b);
+}
+
+fixed fx_abs(fixed v) {
+    return (v < 0) ? -v : v;
 }
 
-float32 lerp(float32 a, float32 b, float32 t) {
-    return (b - a) * t + a;
+fixed lerp(fixed a, fixed b, fixed t) {
+    return fx_mul(b - a, t) + a;
 }
 
-float32 clamp(float32 v, float32 min, float32 max) {
+fixed clamp(fixed v, fixed min, fixed max) {
     return (v < min) ? min : (v > max) ? max : v;
 }
 
-float32 clamp01(float32 v) {
-    return clamp(v, 0.f, 1.f);
+fixed clamp01(fixed v) {
+    return clamp(v, 0, FX_ONE);
 }
 
-float32 clamp_range(float32 v, Range* range) {
+fixed clamp_range(fixed v, Range* range) {
     return clamp(v, range->min, range->max);
 }
 
-float32 lerp_range(Range* range, float32 t) {
+fixed lerp_range(Range* range, fixed t) {
     return lerp(range->min, range->max, t);
 }
 
-float32 lerp_clamp_range(Range* range, float32 t) {
+fixed lerp_clamp_range(Range* range, fixed t) {
     return lerp_range(range, clamp01(t));
-}
\ No newline at end of file
+}